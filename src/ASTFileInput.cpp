@@ -0,0 +1,428 @@
+#include "ASTFileInput.h"
+#include "clang/Basic/SourceManager.h"
+#include "clang/Frontend/ASTUnit.h"
+#include "clang/Lex/MacroInfo.h"
+#include "clang/Lex/PreprocessingRecord.h"
+#include "clang/Lex/Preprocessor.h"
+#include "llvm/ADT/OwningPtr.h"
+#include <algorithm>
+#include <climits>
+#include <iostream>
+#include <map>
+#include <set>
+#include <vector>
+
+using namespace clang;
+using namespace llvm;
+
+namespace {
+
+/**
+ * Orders files by the order the preprocessor entered them.
+ */
+class EnteredEarlier
+{
+  const SourceManager& sourceManager_;
+
+public:
+  EnteredEarlier (const SourceManager& sourceManager):
+    sourceManager_(sourceManager)
+  { }
+
+  bool operator() (FileID left, FileID right) const
+  {
+    return sourceManager_.getSLocEntry(left).getOffset()
+        < sourceManager_.getSLocEntry(right).getOffset();
+  }
+};
+
+/**
+ * Orders #include directives in the same file by position.
+ */
+class AppearsEarlier
+{
+  const SourceManager& sourceManager_;
+
+public:
+  AppearsEarlier (const SourceManager& sourceManager):
+    sourceManager_(sourceManager)
+  { }
+
+  bool operator() (
+      const InclusionDirective* pLeft, const InclusionDirective* pRight) const
+  {
+    return sourceManager_.getFileOffset(pLeft->getSourceRange().getBegin())
+        < sourceManager_.getFileOffset(pRight->getSourceRange().getBegin());
+  }
+};
+
+/**
+ * Replays to the finder the preprocessor events which would have built the
+ * include structure of the translation unit.
+ */
+class IncludeReplay
+{
+  UnnecessaryIncludeFinder& finder_;
+  SourceManager& sourceManager_;
+  const FileEntry* pMainFile_;
+  FileID mainFileID_;
+
+  // #include directives recorded in each file, in source order
+  typedef std::vector<InclusionDirective*> Directives;
+  typedef std::map<FileID, Directives> FileToDirectivesMap;
+  FileToDirectivesMap fileToDirectivesMap_;
+
+  // number of directives of each file already replayed
+  typedef std::map<FileID, std::size_t> FileToCountMap;
+  FileToCountMap fileToReplayedMap_;
+
+  // directives which entered a file
+  std::set<const InclusionDirective*> entered_;
+
+  // files currently entered
+  std::vector<FileID> stack_;
+
+  unsigned offsetOf (SourceLocation location) const
+  { return sourceManager_.getFileOffset(location); }
+
+  InclusionDirective* findDirective(
+      FileID parent, unsigned includeOffset, const FileEntry* pFile);
+  void replaySkipped(FileID fileID, unsigned beforeOffset);
+  void enter(
+      FileID fileID,
+      const FileEntry* pFile,
+      SourceLocation includeLocation,
+      const InclusionDirective* pDirective);
+  void exit();
+
+public:
+  IncludeReplay (
+      UnnecessaryIncludeFinder& finder,
+      SourceManager& sourceManager,
+      const FileEntry* pMainFile):
+    finder_(finder),
+    sourceManager_(sourceManager),
+    pMainFile_(pMainFile)
+  { }
+
+  /**
+   * Uses the #include directives recorded in the preprocessing record.
+   */
+  void addDirectives(PreprocessingRecord& record);
+
+  /**
+   * @return false if the main source file was not found
+   */
+  bool run();
+};
+
+void
+IncludeReplay::addDirectives (PreprocessingRecord& record)
+{
+  for (PreprocessingRecord::iterator pEntity = record.begin();
+      pEntity != record.end();
+      ++pEntity)
+  {
+    InclusionDirective* pDirective =
+        dyn_cast_or_null<InclusionDirective>(*pEntity);
+    if (pDirective == 0 || pDirective->getSourceRange().getBegin().isInvalid())
+    {
+      continue;
+    }
+
+    FileID fileID = sourceManager_.getFileID(
+        pDirective->getSourceRange().getBegin());
+    fileToDirectivesMap_[fileID].push_back(pDirective);
+  }
+
+  for (FileToDirectivesMap::iterator pPair = fileToDirectivesMap_.begin();
+      pPair != fileToDirectivesMap_.end();
+      ++pPair)
+  {
+    std::stable_sort(
+        pPair->second.begin(),
+        pPair->second.end(),
+        AppearsEarlier(sourceManager_));
+  }
+}
+
+InclusionDirective*
+IncludeReplay::findDirective (
+    FileID parent, unsigned includeOffset, const FileEntry* pFile)
+{
+  Directives& directives = fileToDirectivesMap_[parent];
+  for (Directives::iterator ppDirective = directives.begin();
+      ppDirective != directives.end();
+      ++ppDirective)
+  {
+    InclusionDirective* pDirective = *ppDirective;
+    SourceRange range = pDirective->getSourceRange();
+    if (pDirective->getFile() == pFile
+     && offsetOf(range.getBegin()) <= includeOffset
+     && includeOffset <= offsetOf(range.getEnd())
+     && entered_.insert(pDirective).second)
+    {
+      return pDirective;
+    }
+  }
+  return 0;
+}
+
+void
+IncludeReplay::replaySkipped (FileID fileID, unsigned beforeOffset)
+{
+  FileToDirectivesMap::iterator pPair = fileToDirectivesMap_.find(fileID);
+  if (pPair == fileToDirectivesMap_.end()) {
+    return;
+  }
+
+  // Directives which did not enter a file named a header the preprocessor
+  // skipped, usually because of an include guard.
+  Directives& directives = pPair->second;
+  std::size_t& replayed = fileToReplayedMap_[fileID];
+  while (replayed < directives.size()
+   && offsetOf(directives[replayed]->getSourceRange().getBegin())
+          < beforeOffset)
+  {
+    InclusionDirective* pDirective = directives[replayed++];
+    if (entered_.count(pDirective) || pDirective->getFile() == 0) {
+      continue;
+    }
+
+    Token fileNameToken;
+    fileNameToken.startToken();
+    finder_.InclusionDirective(
+        pDirective->getSourceRange().getBegin(),
+        fileNameToken,
+        pDirective->getFileName(),
+        pDirective->wasInBrackets(),
+        CharSourceRange(),
+        pDirective->getFile(),
+        StringRef(),
+        StringRef(),
+        0);
+    finder_.FileSkipped(*pDirective->getFile(), fileNameToken, SrcMgr::C_User);
+  }
+}
+
+void
+IncludeReplay::enter (
+    FileID fileID,
+    const FileEntry* pFile,
+    SourceLocation includeLocation,
+    const InclusionDirective* pDirective)
+{
+  if (pFile != 0 && includeLocation.isValid()) {
+    Token includeToken;
+    includeToken.startToken();
+    if (pDirective != 0) {
+      finder_.InclusionDirective(
+          pDirective->getSourceRange().getBegin(),
+          includeToken,
+          pDirective->getFileName(),
+          pDirective->wasInBrackets(),
+          CharSourceRange(),
+          pFile,
+          StringRef(),
+          StringRef(),
+          0);
+    } else {
+      // Without a preprocessing record, the file name as spelled is not
+      // known.
+      finder_.InclusionDirective(
+          includeLocation,
+          includeToken,
+          pFile->getName(),
+          false,
+          CharSourceRange(),
+          pFile,
+          StringRef(),
+          StringRef(),
+          0);
+    }
+  }
+
+  SourceLocation startLocation = sourceManager_.getLocForStartOfFile(fileID);
+  finder_.FileChanged(
+      startLocation,
+      PPCallbacks::EnterFile,
+      sourceManager_.getFileCharacteristic(startLocation),
+      FileID());
+  stack_.push_back(fileID);
+}
+
+void
+IncludeReplay::exit ()
+{
+  FileID fileID = stack_.back();
+  replaySkipped(fileID, UINT_MAX);
+
+  stack_.pop_back();
+  finder_.FileChanged(
+      stack_.empty()
+          ? SourceLocation()
+          : sourceManager_.getLocForStartOfFile(stack_.back()),
+      PPCallbacks::ExitFile,
+      SrcMgr::C_User,
+      fileID);
+}
+
+bool
+IncludeReplay::run ()
+{
+  // The AST file recorded an entry for each file the preprocessor entered.
+  std::vector<FileID> files;
+  for (unsigned i = 0; i < sourceManager_.loaded_sloc_entry_size(); ++i) {
+    bool invalid = false;
+    const SrcMgr::SLocEntry& entry =
+        sourceManager_.getLoadedSLocEntry(i, &invalid);
+    if (invalid || !entry.isFile()) {
+      continue;
+    }
+
+    FileID fileID = FileID::get(-static_cast<int>(i) - 2);
+    files.push_back(fileID);
+    if (mainFileID_.isInvalid()
+     && sourceManager_.getFileEntryForID(fileID) == pMainFile_)
+    {
+      mainFileID_ = fileID;
+    }
+  }
+  if (mainFileID_.isInvalid()) {
+    return false;
+  }
+
+  std::sort(files.begin(), files.end(), EnteredEarlier(sourceManager_));
+
+  for (std::vector<FileID>::iterator pFileID = files.begin();
+      pFileID != files.end();
+      ++pFileID)
+  {
+    FileID fileID = *pFileID;
+    const FileEntry* pFile = sourceManager_.getFileEntryForID(fileID);
+    SourceLocation includeLocation =
+        sourceManager_.getSLocEntry(fileID).getFile().getIncludeLoc();
+
+    if (fileID == mainFileID_) {
+      if (stack_.empty()) {
+        enter(fileID, pFile, SourceLocation(), 0);
+      }
+      continue;
+    }
+
+    // The predefines buffer is entered from the main source file.
+    FileID parent;
+    if (includeLocation.isValid()) {
+      parent = sourceManager_.getFileID(includeLocation);
+    } else if (pFile == 0) {
+      parent = mainFileID_;
+    } else {
+      continue;
+    }
+
+    if (std::find(stack_.begin(), stack_.end(), parent) == stack_.end()) {
+      continue;
+    }
+    while (stack_.back() != parent) {
+      exit();
+    }
+
+    const InclusionDirective* pDirective = 0;
+    if (includeLocation.isValid()) {
+      unsigned includeOffset = offsetOf(includeLocation);
+      pDirective = findDirective(parent, includeOffset, pFile);
+      replaySkipped(parent, includeOffset);
+    }
+    enter(fileID, pFile, includeLocation, pDirective);
+  }
+
+  while (!stack_.empty()) {
+    exit();
+  }
+  return true;
+}
+
+/**
+ * Replays the recorded macro expansions as uses of the macros.
+ */
+void
+replayMacroExpansions (
+    UnnecessaryIncludeFinder& finder, PreprocessingRecord& record)
+{
+  for (PreprocessingRecord::iterator pEntity = record.begin();
+      pEntity != record.end();
+      ++pEntity)
+  {
+    MacroExpansion* pExpansion = dyn_cast_or_null<MacroExpansion>(*pEntity);
+    if (pExpansion == 0 || pExpansion->isBuiltinMacro()) {
+      continue;
+    }
+
+    MacroDefinition* pDefinition = pExpansion->getDefinition();
+    if (pDefinition == 0) {
+      continue;
+    }
+
+    MacroInfo macroInfo(pDefinition->getLocation());
+    Token nameToken;
+    nameToken.startToken();
+    nameToken.setKind(tok::identifier);
+    nameToken.setLocation(pExpansion->getSourceRange().getBegin());
+    nameToken.setIdentifierInfo(
+        const_cast<IdentifierInfo*>(pDefinition->getName()));
+    finder.MacroExpands(nameToken, &macroInfo, pExpansion->getSourceRange());
+  }
+}
+
+}//namespace
+
+bool
+analyzeASTFile (
+    UnnecessaryIncludeFinderAction& action,
+    CompilerInstance& compiler,
+    const std::string& path)
+{
+  OwningPtr<ASTUnit> pUnit(ASTUnit::LoadFromASTFile(
+      path,
+      IntrusiveRefCntPtr<DiagnosticsEngine>(&compiler.getDiagnostics()),
+      compiler.getFileSystemOpts()));
+  if (!pUnit) {
+    return false;
+  }
+
+  const FileEntry* pMainFile =
+      pUnit->getFileManager().getFile(pUnit->getOriginalSourceFileName());
+  if (pMainFile == 0) {
+    return false;
+  }
+
+  Preprocessor& preprocessor = pUnit->getPreprocessor();
+  UnnecessaryIncludeFinder finder(
+      action,
+      pUnit->getSourceManager(),
+      pUnit->getASTContext().getLangOpts(),
+      preprocessor.getHeaderSearchInfo());
+  finder.setMainFile(pMainFile);
+
+  PreprocessingRecord* pRecord = preprocessor.getPreprocessingRecord();
+  IncludeReplay replay(finder, pUnit->getSourceManager(), pMainFile);
+  if (pRecord != 0) {
+    replay.addDirectives(*pRecord);
+  } else {
+    // Headers used only through macros would be reported as unnecessary.
+    std::cerr << "warning: " << path
+        << " has no detailed preprocessing record, so macro uses and"
+           " headers skipped by include guards are not seen.  Rebuild it"
+           " with -Xclang -detailed-preprocessing-record" << std::endl;
+  }
+  if (!replay.run()) {
+    return false;
+  }
+
+  if (pRecord != 0) {
+    replayMacroExpansions(finder, *pRecord);
+  }
+
+  finder.HandleTranslationUnit(pUnit->getASTContext());
+  return true;
+}
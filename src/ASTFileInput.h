@@ -0,0 +1,24 @@
+#ifndef ASTFILEINPUT_H
+#define ASTFILEINPUT_H
+
+#include "clang/Frontend/CompilerInstance.h"
+#include "UnnecessaryIncludeFinder.h"
+#include <string>
+
+/**
+ * Analyzes a serialized AST file written by clang -emit-ast, without
+ * preprocessing or parsing the source.  The include structure is rebuilt
+ * from the source locations recorded in the AST file.  If the AST file was
+ * written with -detailed-preprocessing-record, the recorded #include
+ * directives give the header names as spelled, including headers skipped by
+ * include guards, and the recorded macro expansions count as uses.
+ * Otherwise a warning recommends rebuilding the AST file with it.
+ *
+ * @return false if the AST file could not be loaded
+ */
+bool analyzeASTFile(
+    UnnecessaryIncludeFinderAction& action,
+    clang::CompilerInstance& compiler,
+    const std::string& path);
+
+#endif
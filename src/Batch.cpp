@@ -0,0 +1,529 @@
+#include "Batch.h"
+#include "clang/Frontend/CompilerInstance.h"
+#include "llvm/Support/Timer.h"
+#include "PathUtil.h"
+#include "UnnecessaryIncludeFinder.h"
+#include <iostream>
+#ifndef _WIN32
+#include <cerrno>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <poll.h>
+#include <sstream>
+#include <string>
+#include <sys/resource.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+using namespace clang;
+using namespace llvm;
+
+#ifdef _WIN32
+
+bool
+Batch::run (const PlannedInputs& inputs, std::ostream& out)
+{
+  std::cerr << "error: --batch is not supported on this platform"
+      << std::endl;
+  return true;
+}
+
+#else
+
+namespace {
+
+// Outcome of analyzing an input, sent by a child process.
+enum Status
+{
+  STATUS_CLEAN,
+  STATUS_FOUND,
+  STATUS_FAILED
+};
+
+// How often to check timeouts and memory use of child processes.
+const int POLL_MILLISECONDS = 100;
+
+const std::size_t BYTES_PER_MEGABYTE = 1 << 20;
+
+bool
+writeAll (int fd, const char* data, std::size_t size)
+{
+  while (size > 0) {
+    ssize_t written = write(fd, data, size);
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return false;
+    }
+    data += written;
+    size -= written;
+  }
+  return true;
+}
+
+/**
+ * Reads a line without the terminating newline.
+ *
+ * @return false at end of file
+ */
+bool
+readLine (int fd, std::string& line)
+{
+  line.clear();
+  char c;
+  for (;;) {
+    ssize_t count = read(fd, &c, 1);
+    if (count < 0 && errno == EINTR) {
+      continue;
+    }
+    if (count <= 0) {
+      return false;
+    }
+    if (c == '\n') {
+      return true;
+    }
+    line += c;
+  }
+}
+
+/**
+ * Gets resident memory of a process in bytes, or 0 if unknown.
+ */
+std::size_t
+getResidentBytes (pid_t pid)
+{
+#ifdef __linux__
+  std::ostringstream path;
+  path << "/proc/" << pid << "/statm";
+  std::ifstream in(path.str().c_str());
+  std::size_t totalPages;
+  std::size_t residentPages;
+  if (in >> totalPages >> residentPages) {
+    return residentPages * sysconf(_SC_PAGESIZE);
+  }
+#endif
+  return 0;
+}
+
+Status
+analyzeInput (Driver& driver, const PlannedInput& input, std::ostream& out)
+{
+  CompilerInstance compiler;
+  if (!driver.initializeCompiler(compiler, input.args_, input.input_)) {
+    return STATUS_FAILED;
+  }
+
+  UnnecessaryIncludeFinderAction action(driver.options());
+  if (!compiler.ExecuteAction(action)) {
+    return STATUS_FAILED;
+  }
+  return action.reportUnnecessaryIncludes(out) ? STATUS_FOUND : STATUS_CLEAN;
+}
+
+/**
+ * Runs in a child process.  Reads indexes of inputs to analyze one per line,
+ * and for each writes a line "<index> <status> <length>" followed by length
+ * bytes of report.
+ */
+void
+serveInputs (
+    Driver& driver,
+    const PlannedInputs& inputs,
+    int taskFd,
+    int resultFd)
+{
+#ifndef __linux__
+  // Without a way to watch resident memory, limit address space instead.
+  std::size_t memoryLimit = driver.options().memoryLimit_;
+  if (memoryLimit != 0) {
+    struct rlimit limit;
+    limit.rlim_cur = limit.rlim_max = memoryLimit * BYTES_PER_MEGABYTE;
+    setrlimit(RLIMIT_AS, &limit);
+  }
+#endif
+
+  std::string line;
+  while (readLine(taskFd, line)) {
+    std::size_t index = std::strtoul(line.c_str(), 0, 10);
+    std::ostringstream report;
+    Status status = analyzeInput(driver, inputs[index], report);
+
+    std::ostringstream message;
+    message << index << ' ' << status << ' ' << report.str().size() << '\n'
+        << report.str();
+    if (!writeAll(resultFd, message.str().data(), message.str().size())) {
+      break;
+    }
+  }
+}
+
+/**
+ * Child process and the input it is analyzing.
+ */
+struct Worker
+{
+  pid_t pid_;
+
+  // pipe to send input indexes to the child process
+  int taskFd_;
+
+  // pipe to receive results from the child process
+  int resultFd_;
+
+  // inputs analyzed by the child process
+  unsigned analyzed_;
+
+  // index of the input being analyzed, or -1 if idle
+  int input_;
+
+  // wall clock time analysis of the input started
+  double startTime_;
+
+  // result received so far
+  std::string received_;
+
+  Worker ():
+    pid_(0),
+    taskFd_(-1),
+    resultFd_(-1),
+    analyzed_(0),
+    input_(-1),
+    startTime_(0.0)
+  { }
+};
+
+double
+now ()
+{
+  return TimeRecord::getCurrentTime().getWallTime();
+}
+
+class Supervisor
+{
+  Driver& driver_;
+  const PlannedInputs& inputs_;
+  std::vector<Worker> workers_;
+  std::vector<std::string> reports_;
+  unsigned finished_;
+  bool foundUnnecessary_;
+
+  bool start(Worker& worker);
+  void stop(Worker& worker);
+  void fail(Worker& worker, const std::string& reason);
+  void receive(Worker& worker);
+  void check(Worker& worker);
+
+public:
+  Supervisor (
+      Driver& driver,
+      const PlannedInputs& inputs,
+      unsigned workerCount):
+    driver_(driver),
+    inputs_(inputs),
+    workers_(workerCount),
+    reports_(inputs.size()),
+    finished_(0),
+    foundUnnecessary_(false)
+  { }
+
+  bool run(std::ostream& out);
+};
+
+bool
+Supervisor::start (Worker& worker)
+{
+  int taskPipe[2];
+  int resultPipe[2];
+  if (pipe(taskPipe) != 0) {
+    return false;
+  }
+  if (pipe(resultPipe) != 0) {
+    close(taskPipe[0]);
+    close(taskPipe[1]);
+    return false;
+  }
+
+  // Do not let the child process repeat buffered output.
+  std::cout.flush();
+  std::cerr.flush();
+
+  pid_t pid = fork();
+  if (pid < 0) {
+    close(taskPipe[0]);
+    close(taskPipe[1]);
+    close(resultPipe[0]);
+    close(resultPipe[1]);
+    return false;
+  }
+
+  if (pid == 0) {
+    // Close the pipes of other child processes, so they see end of file when
+    // the parent closes them.
+    for (std::vector<Worker>::iterator pWorker = workers_.begin();
+        pWorker != workers_.end();
+        ++pWorker)
+    {
+      if (pWorker->pid_ != 0) {
+        close(pWorker->taskFd_);
+        close(pWorker->resultFd_);
+      }
+    }
+    close(taskPipe[1]);
+    close(resultPipe[0]);
+
+    serveInputs(driver_, inputs_, taskPipe[0], resultPipe[1]);
+    _exit(0);
+  }
+
+  close(taskPipe[0]);
+  close(resultPipe[1]);
+  worker.pid_ = pid;
+  worker.taskFd_ = taskPipe[1];
+  worker.resultFd_ = resultPipe[0];
+  worker.analyzed_ = 0;
+  worker.input_ = -1;
+  worker.received_.clear();
+  return true;
+}
+
+void
+Supervisor::stop (Worker& worker)
+{
+  close(worker.taskFd_);
+  close(worker.resultFd_);
+
+  int status;
+  while (waitpid(worker.pid_, &status, 0) < 0 && errno == EINTR) {
+  }
+
+  worker.pid_ = 0;
+  worker.input_ = -1;
+}
+
+void
+Supervisor::fail (Worker& worker, const std::string& reason)
+{
+  std::cerr << "error: cannot analyze "
+      << inputs_[worker.input_].input_.getFile().str() << ": " << reason
+      << std::endl;
+  foundUnnecessary_ = true;
+  ++finished_;
+}
+
+void
+Supervisor::receive (Worker& worker)
+{
+  char buffer[4096];
+  ssize_t count = read(worker.resultFd_, buffer, sizeof(buffer));
+  if (count < 0) {
+    if (errno == EINTR || errno == EAGAIN) {
+      return;
+    }
+    count = 0;
+  }
+
+  if (count == 0) {
+    // The child process exited before finishing the input.
+    kill(worker.pid_, SIGKILL);
+    int status = 0;
+    while (waitpid(worker.pid_, &status, 0) < 0 && errno == EINTR) {
+    }
+
+    std::ostringstream reason;
+    if (WIFSIGNALED(status)) {
+      reason << "crashed with signal " << WTERMSIG(status);
+    } else {
+      reason << "exited with status " << WEXITSTATUS(status);
+    }
+    fail(worker, reason.str());
+
+    close(worker.taskFd_);
+    close(worker.resultFd_);
+    worker.pid_ = 0;
+    worker.input_ = -1;
+    return;
+  }
+
+  worker.received_.append(buffer, count);
+
+  std::string::size_type newline = worker.received_.find('\n');
+  if (newline == std::string::npos) {
+    return;
+  }
+
+  std::istringstream header(worker.received_.substr(0, newline));
+  std::size_t index;
+  int status;
+  std::size_t length;
+  header >> index >> status >> length;
+  if (worker.received_.size() < newline + 1 + length) {
+    return;
+  }
+
+  if (status == STATUS_FAILED) {
+    fail(worker, "compilation failed");
+  } else {
+    reports_[index] = worker.received_.substr(newline + 1, length);
+    if (status == STATUS_FOUND) {
+      foundUnnecessary_ = true;
+    }
+    ++finished_;
+
+    driver_.costHistory().record(
+        normalizePath(inputs_[index].input_.getFile()),
+        now() - worker.startTime_);
+  }
+
+  worker.received_.clear();
+  worker.input_ = -1;
+  ++worker.analyzed_;
+}
+
+void
+Supervisor::check (Worker& worker)
+{
+  const ToolOptions& options = driver_.options();
+
+  const char* reason = 0;
+  if (options.timeout_ != 0 && now() - worker.startTime_ > options.timeout_) {
+    reason = "timed out";
+  } else if (options.memoryLimit_ != 0
+   && getResidentBytes(worker.pid_)
+          > options.memoryLimit_ * BYTES_PER_MEGABYTE)
+  {
+    reason = "exceeded memory limit";
+  }
+
+  if (reason != 0) {
+    kill(worker.pid_, SIGKILL);
+    fail(worker, reason);
+    stop(worker);
+  }
+}
+
+bool
+Supervisor::run (std::ostream& out)
+{
+  const ToolOptions& options = driver_.options();
+  bool supervised = options.timeout_ != 0 || options.memoryLimit_ != 0;
+
+  // Writing to a pipe of a crashed child process must not kill this process.
+  void (*previousHandler)(int) = std::signal(SIGPIPE, SIG_IGN);
+
+  // Hand out the largest inputs first.
+  std::vector<std::size_t> schedule = scheduleLargestFirst(inputs_);
+  std::size_t next = 0;
+  while (finished_ < inputs_.size()) {
+    // Give an input to each idle worker, replacing child processes which
+    // have analyzed enough inputs.
+    for (std::vector<Worker>::iterator pWorker = workers_.begin();
+        pWorker != workers_.end() && next < inputs_.size();
+        ++pWorker)
+    {
+      Worker& worker = *pWorker;
+      if (worker.input_ >= 0) {
+        continue;
+      }
+
+      if (worker.pid_ != 0
+       && options.recycleAfter_ != 0
+       && worker.analyzed_ >= options.recycleAfter_)
+      {
+        stop(worker);
+      }
+
+      if (worker.pid_ == 0 && !start(worker)) {
+        std::cerr << "error: cannot start child process: "
+            << std::strerror(errno) << std::endl;
+        std::signal(SIGPIPE, previousHandler);
+        return true;
+      }
+
+      std::size_t input = schedule[next++];
+      std::ostringstream line;
+      line << input << '\n';
+      worker.input_ = static_cast<int>(input);
+      worker.startTime_ = now();
+
+      // If the child process died while idle, this fails, and the end of
+      // file read below fails the input.
+      writeAll(worker.taskFd_, line.str().data(), line.str().size());
+    }
+
+    std::vector<struct pollfd> pollFds;
+    std::vector<Worker*> polled;
+    for (std::vector<Worker>::iterator pWorker = workers_.begin();
+        pWorker != workers_.end();
+        ++pWorker)
+    {
+      if (pWorker->input_ >= 0) {
+        struct pollfd pollFd;
+        pollFd.fd = pWorker->resultFd_;
+        pollFd.events = POLLIN;
+        pollFd.revents = 0;
+        pollFds.push_back(pollFd);
+        polled.push_back(&*pWorker);
+      }
+    }
+
+    int ready = poll(
+        &pollFds[0], pollFds.size(), supervised ? POLL_MILLISECONDS : -1);
+    if (ready < 0 && errno != EINTR) {
+      std::cerr << "error: cannot wait for child processes: "
+          << std::strerror(errno) << std::endl;
+      break;
+    }
+
+    for (std::size_t i = 0; i < polled.size(); ++i) {
+      if (ready > 0 && pollFds[i].revents != 0) {
+        receive(*polled[i]);
+      }
+      if (supervised && polled[i]->input_ >= 0) {
+        check(*polled[i]);
+      }
+    }
+  }
+
+  for (std::vector<Worker>::iterator pWorker = workers_.begin();
+      pWorker != workers_.end();
+      ++pWorker)
+  {
+    if (pWorker->pid_ != 0) {
+      stop(*pWorker);
+    }
+  }
+  std::signal(SIGPIPE, previousHandler);
+
+  for (std::vector<std::string>::iterator pReport = reports_.begin();
+      pReport != reports_.end();
+      ++pReport)
+  {
+    out << *pReport;
+  }
+  return foundUnnecessary_ || finished_ < inputs_.size();
+}
+
+}//namespace
+
+bool
+Batch::run (const PlannedInputs& inputs, std::ostream& out)
+{
+  if (inputs.empty()) {
+    return false;
+  }
+
+  unsigned workerCount = driver_.threadCount();
+  if (workerCount > inputs.size()) {
+    workerCount = inputs.size();
+  }
+
+  Supervisor supervisor(driver_, inputs, workerCount);
+  return supervisor.run(out);
+}
+
+#endif
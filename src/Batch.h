@@ -0,0 +1,35 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include "Driver.h"
+#include "Plan.h"
+#include <ostream>
+#include <vector>
+
+/**
+ * Analyzes each input in a supervised child process, so a crash, hang or
+ * runaway memory use while analyzing one input fails only that input.
+ * Child processes are recycled after analyzing a number of inputs.
+ * Supported only on POSIX systems.
+ */
+class Batch
+{
+  Driver& driver_;
+
+public:
+  Batch (Driver& driver):
+    driver_(driver)
+  { }
+
+  /**
+   * Analyzes the inputs, largest estimated cost first, and outputs their
+   * reports in input order.  Reports each input which could not be analyzed
+   * and carries on with the others.
+   *
+   * @return true if any unnecessary #include directives were found or an
+   *         input could not be analyzed
+   */
+  bool run(const PlannedInputs& inputs, std::ostream& out);
+};
+
+#endif
@@ -0,0 +1,584 @@
+#include "Driver.h"
+#include "clang/Frontend/CompilerInvocation.h"
+#include "clang/Lex/PreprocessorOptions.h"
+#include "llvm/ADT/OwningPtr.h"
+#include "llvm/ADT/StringSwitch.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/system_error.h"
+#include "llvm/Support/Timer.h"
+#include "Parallel.h"
+#include "PathUtil.h"
+#include "UnnecessaryIncludeFinder.h"
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <set>
+#include <sstream>
+
+using namespace clang;
+using namespace llvm;
+
+void
+setResourceDir (CompilerInstance& compiler, const char* programPath)
+{
+  if (compiler.getHeaderSearchOpts().UseBuiltinIncludes
+   && compiler.getHeaderSearchOpts().ResourceDir.empty())
+  {
+    compiler.getHeaderSearchOpts().ResourceDir =
+        CompilerInvocation::GetResourcesPath(
+            programPath, reinterpret_cast<void*>(setResourceDir));
+  }
+}
+
+namespace {
+
+void
+splitArguments (const std::string& text, std::vector<std::string>& args)
+{
+  std::istringstream in(text);
+  std::string arg;
+  while (in >> arg) {
+    args.push_back(arg);
+  }
+}
+
+typedef std::set<unsigned> FileIds;
+
+bool
+isHeaderFileName (StringRef path)
+{
+  StringRef extension = sys::path::extension(path);
+  return extension == ".h"
+      || extension == ".hh"
+      || extension == ".hpp"
+      || extension == ".hxx"
+      || extension == ".h++";
+}
+
+/**
+ * Gets the kind of the source file synthesized to analyze a header.  The
+ * last -x option gives the language.  Without one, a .h header is C if a
+ * -std option selects a C standard, and any other header is C++.
+ */
+InputKind
+getHeaderInputKind (const std::vector<const char*>& args, StringRef header)
+{
+  std::string language;
+  StringRef standard;
+  for (std::size_t i = 0; i < args.size(); ++i) {
+    StringRef arg(args[i]);
+    if (arg == "-x" && i + 1 < args.size()) {
+      language = args[++i];
+    } else if (arg.startswith("-x")) {
+      language = arg.substr(2);
+    } else if (arg.startswith("-std=")) {
+      standard = arg.substr(5);
+    }
+  }
+
+  if (!language.empty()) {
+    // The synthesized source file includes the header, so a header language
+    // gives the kind of the source file.
+    StringRef kindName(language);
+    if (kindName.endswith("-header")) {
+      kindName = kindName.substr(0, kindName.size() - 7);
+    }
+    return StringSwitch<InputKind>(kindName)
+        .Case("c", IK_C)
+        .Case("objective-c", IK_ObjC)
+        .Case("objective-c++", IK_ObjCXX)
+        .Default(IK_CXX);
+  }
+
+  if (sys::path::extension(header) == ".h"
+   && !standard.empty()
+   && standard.find("++") == StringRef::npos)
+  {
+    return IK_C;
+  }
+  return IK_CXX;
+}
+
+/**
+ * Gets the file name extension of a source file of the kind.
+ */
+const char*
+getSourceExtension (InputKind kind)
+{
+  switch (kind) {
+  case IK_C:
+    return ".c";
+  case IK_ObjC:
+    return ".m";
+  case IK_ObjCXX:
+    return ".mm";
+  default:
+    return ".cpp";
+  }
+}
+
+/**
+ * Adds headers given by a header file name, a directory to search
+ * recursively, or a file listing header file names one per line.
+ *
+ * @return false if the headers could not be found
+ */
+bool
+findHeaders (const std::string& spec, std::vector<std::string>& headers)
+{
+  bool isDirectory;
+  if (!sys::fs::is_directory(spec, isDirectory) && isDirectory) {
+    std::vector<std::string> found;
+    error_code error;
+    for (sys::fs::recursive_directory_iterator pEntry(spec, error), end;
+        pEntry != end && !error;
+        pEntry.increment(error))
+    {
+      bool isFile;
+      if (isHeaderFileName(pEntry->path())
+       && !sys::fs::is_regular_file(pEntry->path(), isFile)
+       && isFile)
+      {
+        found.push_back(pEntry->path());
+      }
+    }
+    if (error) {
+      std::cerr << "error: cannot search " << spec << ": " << error.message()
+          << std::endl;
+      return false;
+    }
+
+    std::sort(found.begin(), found.end());
+    headers.insert(headers.end(), found.begin(), found.end());
+    return true;
+  }
+
+  if (isHeaderFileName(spec)) {
+    headers.push_back(spec);
+    return true;
+  }
+
+  std::ifstream in(spec.c_str());
+  if (!in) {
+    std::cerr << "error: cannot read " << spec << std::endl;
+    return false;
+  }
+
+  std::string line;
+  while (std::getline(in, line)) {
+    if (!line.empty() && line[line.size() - 1] == '\r') {
+      line.erase(line.size() - 1);
+    }
+    if (!line.empty()) {
+      headers.push_back(line);
+    }
+  }
+  return true;
+}
+
+/**
+ * Analysis of one input in one configuration.
+ */
+struct AnalysisJob
+{
+  clang::FrontendInputFile input_;
+  std::string configuration_;
+  std::vector<std::string> extraArgs_;
+
+  // estimated cost, used to start the largest jobs first
+  double cost_;
+
+  // wall clock seconds spent analyzing
+  double seconds_;
+
+  // contents of the input if it is synthesized in memory
+  std::string synthesizedInput_;
+
+  // header to analyze as the main source file, or empty for the input
+  std::string mainHeader_;
+
+  UnnecessaryIncludeFinderAction* pAction_;
+  bool succeeded_;
+
+  // headers included by the main source file
+  FileIds included_;
+
+  // headers found to be unnecessary
+  FileIds unnecessary_;
+  UnnecessaryIncludes found_;
+
+  AnalysisJob (
+      const PlannedInput& input,
+      const std::string& configuration):
+    input_(input.input_),
+    configuration_(configuration),
+    extraArgs_(input.args_),
+    cost_(input.cost_),
+    seconds_(0.0),
+    pAction_(0),
+    succeeded_(false)
+  {
+    splitArguments(configuration, extraArgs_);
+  }
+
+  ~AnalysisJob ()
+  {
+    delete pAction_;
+  }
+};
+
+typedef std::vector<AnalysisJob*> AnalysisJobs;
+
+struct MoreCostlyJob
+{
+  bool operator() (const AnalysisJob* pLeft, const AnalysisJob* pRight) const
+  { return pLeft->cost_ > pRight->cost_; }
+};
+
+class AnalysisTask: public ParallelTask
+{
+  Driver& driver_;
+  AnalysisJobs& jobs_;
+
+public:
+  AnalysisTask (Driver& driver, AnalysisJobs& jobs):
+    driver_(driver),
+    jobs_(jobs)
+  { }
+
+  virtual void run(unsigned index);
+};
+
+void
+AnalysisTask::run (unsigned index)
+{
+  AnalysisJob& job = *jobs_[index];
+  double startTime = TimeRecord::getCurrentTime().getWallTime();
+
+  CompilerInstance compiler;
+  if (!driver_.initializeCompiler(compiler, job.extraArgs_, job.input_)) {
+    return;
+  }
+
+  // This function owns the buffer, so the compiler must retain it.
+  OwningPtr<MemoryBuffer> pSynthesizedInput;
+  if (!job.synthesizedInput_.empty()) {
+    pSynthesizedInput.reset(MemoryBuffer::getMemBufferCopy(
+        job.synthesizedInput_, job.input_.getFile()));
+    PreprocessorOptions& preprocessorOptions = compiler.getPreprocessorOpts();
+    preprocessorOptions.RetainRemappedFileBuffers = true;
+    preprocessorOptions.addRemappedFile(
+        job.input_.getFile(), pSynthesizedInput.get());
+  }
+
+  job.pAction_ = new UnnecessaryIncludeFinderAction(driver_.options());
+  job.pAction_->setMainHeader(job.mainHeader_);
+  job.pAction_->setFileCache(&driver_.fileCache());
+  job.succeeded_ = compiler.ExecuteAction(*job.pAction_);
+  if (compiler.hasSourceManager()) {
+    driver_.fileCache().releaseFiles(compiler.getSourceManager());
+  }
+
+  const UnnecessaryIncludeFinderAction::SourceFiles& mainSources =
+      job.pAction_->mainSources();
+  for (UnnecessaryIncludeFinderAction::SourceFiles::const_iterator ppSource =
+          mainSources.begin();
+      ppSource != mainSources.end();
+      ++ppSource)
+  {
+    SourceFile::IncludeDirectives& includeDirectives =
+        (*ppSource)->includeDirectives_;
+    for (SourceFile::IncludeDirectives::iterator ppInclude =
+            includeDirectives.begin();
+        ppInclude != includeDirectives.end();
+        ++ppInclude)
+    {
+      job.included_.insert(
+          driver_.fileIds().getId((*ppInclude)->pHeader_->name()));
+    }
+  }
+
+  job.pAction_->findUnnecessaryIncludes(job.found_);
+  for (UnnecessaryIncludes::iterator pFound = job.found_.begin();
+      pFound != job.found_.end();
+      ++pFound)
+  {
+    job.unnecessary_.insert(driver_.fileIds().getId(
+        pFound->pIncludeDirective_->pHeader_->name()));
+  }
+
+  job.seconds_ = TimeRecord::getCurrentTime().getWallTime() - startTime;
+}
+
+}//namespace
+
+bool
+Driver::reportUnnecessaryIncludes (
+    UnnecessaryIncludes& found, std::ostream& out)
+{
+  if (options_.sortBy_ != COST_NONE) {
+    sortByCost(found, options_.sortBy_);
+  }
+
+  for (UnnecessaryIncludes::iterator pFound = found.begin();
+      pFound != found.end();
+      ++pFound)
+  {
+    pFound->report(out, options_.cost_);
+  }
+  return !found.empty();
+}
+
+unsigned
+Driver::threadCount () const
+{
+  return (options_.jobs_ != 0) ? options_.jobs_ : hardwareConcurrency();
+}
+
+bool
+Driver::initializeCompiler (
+    CompilerInstance& compiler,
+    const std::vector<std::string>& extraArgs,
+    const FrontendInputFile& input)
+{
+  compiler.createDiagnostics();
+
+  std::vector<const char*> args(clangArgs_);
+  for (std::vector<std::string>::const_iterator pArg = extraArgs.begin();
+      pArg != extraArgs.end();
+      ++pArg)
+  {
+    args.push_back(pArg->c_str());
+  }
+
+  if (!CompilerInvocation::CreateFromArgs(
+      compiler.getInvocation(),
+      args.data(),
+      args.data() + args.size(),
+      compiler.getDiagnostics()))
+  {
+    return false;
+  }
+
+  // Arguments converted from a build command name the input, preceded by
+  // any -x option giving its kind.
+  std::vector<FrontendInputFile>& inputs = compiler.getFrontendOpts().Inputs;
+  InputKind kind = input.getKind();
+  if (!inputs.empty()
+   && inputs.back().getFile() == input.getFile()
+   && inputs.back().getKind() != IK_None)
+  {
+    kind = inputs.back().getKind();
+  }
+  inputs.clear();
+  inputs.push_back(FrontendInputFile(input.getFile(), kind));
+
+  setResourceDir(compiler, programPath_);
+  fileCache_.attach(compiler);
+  if (!options_.headerMapCacheDir_.empty()) {
+    headerMapCache_.attach(compiler);
+  }
+  return true;
+}
+
+bool
+Driver::analyzeHeaders (std::ostream& out, bool& foundUnnecessary)
+{
+  foundUnnecessary = false;
+  std::vector<std::string> headers;
+  for (std::vector<std::string>::const_iterator pSpec =
+          options_.headers_.begin();
+      pSpec != options_.headers_.end();
+      ++pSpec)
+  {
+    if (!findHeaders(*pSpec, headers)) {
+      return false;
+    }
+  }
+  if (headers.empty()) {
+    std::cerr << "error: no headers found to analyze" << std::endl;
+    return false;
+  }
+
+  // For each header, synthesize a source file in the same directory which
+  // includes only the header.
+  AnalysisJobs jobs;
+  for (std::vector<std::string>::iterator pHeader = headers.begin();
+      pHeader != headers.end();
+      ++pHeader)
+  {
+    InputKind kind = getHeaderInputKind(clangArgs_, *pHeader);
+    FrontendInputFile input(
+        *pHeader + ".fui" + getSourceExtension(kind), kind);
+    AnalysisJob* pJob = new AnalysisJob(PlannedInput(input), std::string());
+    pJob->synthesizedInput_ =
+        "#include \"" + sys::path::filename(*pHeader).str() + "\"\n";
+    pJob->mainHeader_ = *pHeader;
+    jobs.push_back(pJob);
+  }
+
+  AnalysisTask task(*this, jobs);
+  parallelFor(jobs.size(), task, threadCount());
+
+  UnnecessaryIncludes found;
+  for (AnalysisJobs::iterator ppJob = jobs.begin();
+      ppJob != jobs.end();
+      ++ppJob)
+  {
+    if (!(*ppJob)->succeeded_) {
+      std::cerr << "error: cannot analyze " << (*ppJob)->mainHeader_
+          << std::endl;
+      foundUnnecessary = true;
+      continue;
+    }
+
+    found.insert(found.end(), (*ppJob)->found_.begin(), (*ppJob)->found_.end());
+    results_.merge(*(*ppJob)->pAction_);
+  }
+
+  if (reportUnnecessaryIncludes(found, out)) {
+    foundUnnecessary = true;
+  }
+
+  for (AnalysisJobs::iterator ppJob = jobs.begin();
+      ppJob != jobs.end();
+      ++ppJob)
+  {
+    delete *ppJob;
+  }
+  return true;
+}
+
+bool
+Driver::analyzeConfigurations (const PlannedInputs& inputs, std::ostream& out)
+{
+  // Without configurations, analyze the command line configuration.
+  std::vector<std::string> configurations(options_.configurations_);
+  if (configurations.empty()) {
+    configurations.push_back(std::string());
+  }
+
+  // Jobs are ordered by input, then configuration.
+  AnalysisJobs jobs;
+  for (PlannedInputs::const_iterator pInput = inputs.begin();
+      pInput != inputs.end();
+      ++pInput)
+  {
+    for (std::vector<std::string>::const_iterator pConfiguration =
+            configurations.begin();
+        pConfiguration != configurations.end();
+        ++pConfiguration)
+    {
+      jobs.push_back(new AnalysisJob(*pInput, *pConfiguration));
+    }
+  }
+
+  // Analyze the first configuration of every input, which fills the file
+  // cache, then the other configurations, which mostly read from it.
+  AnalysisJobs firstJobs;
+  AnalysisJobs otherJobs;
+  for (std::size_t i = 0; i < jobs.size(); ++i) {
+    if (i % configurations.size() == 0) {
+      firstJobs.push_back(jobs[i]);
+    } else {
+      otherJobs.push_back(jobs[i]);
+    }
+  }
+
+  // Start the largest jobs first, so no large job is left running alone at
+  // the end.
+  std::stable_sort(firstJobs.begin(), firstJobs.end(), MoreCostlyJob());
+  std::stable_sort(otherJobs.begin(), otherJobs.end(), MoreCostlyJob());
+
+  AnalysisTask firstTask(*this, firstJobs);
+  parallelFor(firstJobs.size(), firstTask, threadCount());
+  AnalysisTask otherTask(*this, otherJobs);
+  parallelFor(otherJobs.size(), otherTask, threadCount());
+
+  bool foundUnnecessary = false;
+  UnnecessaryIncludes found;
+  for (std::size_t first = 0;
+      first < jobs.size();
+      first += configurations.size())
+  {
+    AnalysisJobs::iterator pBegin = jobs.begin() + first;
+    AnalysisJobs::iterator pEnd = pBegin + configurations.size();
+
+    bool succeeded = true;
+    double seconds = 0.0;
+    for (AnalysisJobs::iterator ppJob = pBegin; ppJob != pEnd; ++ppJob) {
+      if (!(*ppJob)->succeeded_) {
+        std::cerr << "error: cannot analyze "
+            << (*ppJob)->input_.getFile().str();
+        if (!options_.configurations_.empty()) {
+          std::cerr << " with configuration '" << (*ppJob)->configuration_
+              << "'";
+        }
+        std::cerr << std::endl;
+        succeeded = false;
+      }
+      seconds += (*ppJob)->seconds_;
+    }
+    if (succeeded) {
+      costHistory_.record(normalizePath((*pBegin)->input_.getFile()), seconds);
+    } else {
+      foundUnnecessary = true;
+      continue;
+    }
+
+    for (AnalysisJobs::iterator ppJob = pBegin; ppJob != pEnd; ++ppJob) {
+      results_.merge(*(*ppJob)->pAction_);
+    }
+
+    // Keep a finding if the header is unnecessary in every configuration
+    // including it.  Report it as found in the first such configuration.
+    FileIds reported;
+    for (AnalysisJobs::iterator ppJob = pBegin; ppJob != pEnd; ++ppJob) {
+      FileIds reportedHere;
+      UnnecessaryIncludes& jobFound = (*ppJob)->found_;
+      for (UnnecessaryIncludes::iterator pFound = jobFound.begin();
+          pFound != jobFound.end();
+          ++pFound)
+      {
+        unsigned header =
+            fileIds_.getId(pFound->pIncludeDirective_->pHeader_->name());
+        if (reported.count(header)) {
+          continue;
+        }
+
+        bool unnecessaryEverywhere = true;
+        for (AnalysisJobs::iterator ppOther = pBegin;
+            ppOther != pEnd;
+            ++ppOther)
+        {
+          if ((*ppOther)->included_.count(header)
+           && !(*ppOther)->unnecessary_.count(header))
+          {
+            unnecessaryEverywhere = false;
+            break;
+          }
+        }
+
+        if (unnecessaryEverywhere) {
+          reportedHere.insert(header);
+          found.push_back(*pFound);
+        }
+      }
+      reported.insert(reportedHere.begin(), reportedHere.end());
+    }
+  }
+
+  if (reportUnnecessaryIncludes(found, out)) {
+    foundUnnecessary = true;
+  }
+
+  for (AnalysisJobs::iterator ppJob = jobs.begin();
+      ppJob != jobs.end();
+      ++ppJob)
+  {
+    delete *ppJob;
+  }
+  return foundUnnecessary;
+}
@@ -0,0 +1,117 @@
+#ifndef DRIVER_H
+#define DRIVER_H
+
+#include "clang/Frontend/CompilerInstance.h"
+#include "clang/Frontend/FrontendOptions.h"
+#include "FileIdTable.h"
+#include "HeaderMapCache.h"
+#include "Plan.h"
+#include "SharedFileCache.h"
+#include "ToolOptions.h"
+#include "UnnecessaryIncludeFinder.h"
+#include <ostream>
+#include <string>
+#include <vector>
+
+/**
+ * Sets the directory of clang's builtin headers relative to the program
+ * location, unless the command line specified it.
+ */
+void setResourceDir(clang::CompilerInstance& compiler, const char* programPath);
+
+/**
+ * Runs analyses needing more than one compiler instance.  The compiler
+ * instances share a file cache and may run on multiple threads.
+ */
+class Driver
+{
+  const ToolOptions& options_;
+  std::vector<const char*> clangArgs_;
+  const char* programPath_;
+  SharedFileCache fileCache_;
+  HeaderMapCache headerMapCache_;
+  FileIdTable fileIds_;
+  CostHistory costHistory_;
+
+  // main source files analyzed by all successful analyses
+  UnnecessaryIncludeFinderAction results_;
+
+  bool reportUnnecessaryIncludes(
+      UnnecessaryIncludes& found, std::ostream& out);
+
+public:
+  Driver (
+      const ToolOptions& options,
+      const std::vector<const char*>& clangArgs,
+      const char* programPath):
+    options_(options),
+    clangArgs_(clangArgs),
+    programPath_(programPath),
+    headerMapCache_(options.headerMapCacheDir_),
+    results_(options)
+  { }
+
+  const ToolOptions& options () const
+  { return options_; }
+
+  SharedFileCache& fileCache ()
+  { return fileCache_; }
+
+  FileIdTable& fileIds ()
+  { return fileIds_; }
+
+  /** seconds spent analyzing inputs in earlier runs, updated by analyses */
+  CostHistory& costHistory ()
+  { return costHistory_; }
+
+  /**
+   * Combines the main source files of all successful analyses, to update the
+   * index, export the include graph or report the summary.
+   */
+  UnnecessaryIncludeFinderAction& results ()
+  { return results_; }
+
+  /**
+   * Number of threads to run.
+   */
+  unsigned threadCount() const;
+
+  /**
+   * Configures the compiler from the command line arguments followed by the
+   * extra arguments, to process only the input.
+   *
+   * @return false if the arguments are invalid
+   */
+  bool initializeCompiler(
+      clang::CompilerInstance& compiler,
+      const std::vector<std::string>& extraArgs,
+      const clang::FrontendInputFile& input);
+
+  /**
+   * Analyzes each input under every configuration given by the options, or
+   * only the command line configuration if none are given.  Reports an
+   * #include directive only if it is unnecessary in every configuration which
+   * includes the header.  The inputs with the largest estimated cost are
+   * started first.
+   *
+   * @return true if any unnecessary #include directives were found or an
+   *         input could not be analyzed
+   */
+  bool analyzeConfigurations(const PlannedInputs& inputs, std::ostream& out);
+
+  /**
+   * Analyzes each header given by the options as if it were a main source
+   * file, by compiling a synthesized source file which includes only the
+   * header.  The synthesized source file is in the language given by a -x
+   * option, otherwise C for a .h header if a -std option selects a C
+   * standard, otherwise C++.
+   *
+   * @param foundUnnecessary
+   *          set to true if any unnecessary #include directives were found
+   *          or a header could not be analyzed
+   * @return false if the headers could not be found
+   */
+  bool analyzeHeaders(std::ostream& out, bool& foundUnnecessary);
+};
+
+#endif
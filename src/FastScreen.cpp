@@ -0,0 +1,183 @@
+#include "FastScreen.h"
+#include "clang/Frontend/Utils.h"
+#include "clang/Lex/Lexer.h"
+#include "llvm/ADT/OwningPtr.h"
+#include "llvm/ADT/Triple.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "PathUtil.h"
+#include <sstream>
+
+using namespace clang;
+using namespace llvm;
+
+namespace {
+
+/**
+ * Extracts the header file name following the directive name.
+ *
+ * @return false if the directive does not name a header
+ */
+bool
+parseIncludeFileName (const char* p, const char* end, ScreenedInclude& include)
+{
+  while (p != end && (*p == ' ' || *p == '\t')) {
+    ++p;
+  }
+  if (p == end || (*p != '<' && *p != '"')) {
+    // The file name is given by a macro.
+    return false;
+  }
+
+  include.angled_ = *p == '<';
+  char terminator = include.angled_ ? '>' : '"';
+  const char* start = ++p;
+  while (p != end && *p != terminator && *p != '\n') {
+    ++p;
+  }
+  if (p == end || *p != terminator) {
+    return false;
+  }
+
+  include.fileName_.assign(start, p);
+  return true;
+}
+
+}//namespace
+
+void
+ScreenedInclude::report (std::ostream& out) const
+{
+  out << location_ << ": warning: #include "
+      << (angled_ ? '<' : '"') << fileName_ << (angled_ ? '>' : '"')
+      << " may be unnecessary [heuristic]" << std::endl;
+}
+
+FastScreen::FastScreen (
+    CompilerInstance& compiler, const SymbolIndex& symbolIndex):
+  langOptions_(compiler.getLangOpts()),
+  symbolIndex_(symbolIndex),
+  fileManager_(compiler.getFileSystemOpts()),
+  sourceManager_(compiler.getDiagnostics(), fileManager_),
+  headerSearch_(fileManager_, compiler.getDiagnostics(), langOptions_, 0)
+{
+  ApplyHeaderSearchOptions(
+      headerSearch_,
+      compiler.getHeaderSearchOpts(),
+      langOptions_,
+      Triple(compiler.getTargetOpts().Triple));
+}
+
+bool
+FastScreen::isCleared (
+    ScreenedInclude& include,
+    const FileEntry* pMainFile,
+    const SymbolIndex::Symbols& identifiers)
+{
+  const DirectoryLookup* pCurDir;
+  const FileEntry* pHeader = headerSearch_.LookupFile(
+      include.fileName_, include.angled_, 0, pCurDir, pMainFile, 0, 0, 0);
+  if (pHeader == 0) {
+    return false;
+  }
+
+  std::string name(normalizePath(pHeader->getName()));
+  const SymbolIndex::Symbols* pNames = symbolIndex_.getScreenNames(name);
+  if (pNames == 0) {
+    return false;
+  }
+
+  // Symbols recorded for an older version of the header cannot be trusted.
+  OwningPtr<MemoryBuffer> pBuffer(fileManager_.getBufferForFile(pHeader));
+  if (!pBuffer
+   || !symbolIndex_.isCurrent(
+          name, SymbolIndex::hashContents(pBuffer->getBuffer())))
+  {
+    return false;
+  }
+  include.indexed_ = true;
+
+  // Members and enumerators are not screened, because their names are
+  // common and usually reached through a namespace scope name.
+  for (SymbolIndex::Symbols::const_iterator pName = pNames->begin();
+      pName != pNames->end();
+      ++pName)
+  {
+    if (identifiers.count(*pName)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool
+FastScreen::screen (
+    const FrontendInputFile& input, std::vector<ScreenedInclude>& uncleared)
+{
+  const FileEntry* pMainFile = fileManager_.getFile(input.getFile());
+  if (pMainFile == 0) {
+    return false;
+  }
+
+  FileID fileID = sourceManager_.createFileID(
+      pMainFile, SourceLocation(), SrcMgr::C_User);
+  bool invalid = false;
+  const MemoryBuffer* pBuffer = sourceManager_.getBuffer(
+      fileID, SourceLocation(), &invalid);
+  if (invalid) {
+    return false;
+  }
+
+  // Collect the identifiers and #include directives.
+  Lexer lexer(fileID, pBuffer, sourceManager_, langOptions_);
+  SymbolIndex::Symbols identifiers;
+  std::vector<ScreenedInclude> includes;
+  Token token;
+  lexer.LexFromRawLexer(token);
+  while (token.isNot(tok::eof)) {
+    if (token.is(tok::hash) && token.isAtStartOfLine()) {
+      SourceLocation hashLoc = token.getLocation();
+      lexer.LexFromRawLexer(token);
+      if (token.is(tok::raw_identifier)) {
+        StringRef directive(token.getRawIdentifierData(), token.getLength());
+        if (directive == "include"
+         || directive == "include_next"
+         || directive == "import")
+        {
+          const char* p = token.getRawIdentifierData() + token.getLength();
+          ScreenedInclude include;
+          if (parseIncludeFileName(p, pBuffer->getBufferEnd(), include)) {
+            std::ostringstream location;
+            location << pMainFile->getName() << ':'
+                << sourceManager_.getSpellingLineNumber(hashLoc) << ':'
+                << sourceManager_.getSpellingColumnNumber(hashLoc);
+            include.location_ = location.str();
+            includes.push_back(include);
+          }
+
+          // Skip the file name, which is not a use of any symbol.
+          do {
+            lexer.LexFromRawLexer(token);
+          } while (token.isNot(tok::eof) && !token.isAtStartOfLine());
+          continue;
+        }
+      }
+      continue;
+    }
+
+    if (token.is(tok::raw_identifier)) {
+      identifiers.insert(
+          std::string(token.getRawIdentifierData(), token.getLength()));
+    }
+    lexer.LexFromRawLexer(token);
+  }
+
+  for (std::vector<ScreenedInclude>::iterator pInclude = includes.begin();
+      pInclude != includes.end();
+      ++pInclude)
+  {
+    if (!isCleared(*pInclude, pMainFile, identifiers)) {
+      uncleared.push_back(*pInclude);
+    }
+  }
+  return true;
+}
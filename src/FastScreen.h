@@ -0,0 +1,81 @@
+#ifndef FASTSCREEN_H
+#define FASTSCREEN_H
+
+#include "clang/Basic/FileManager.h"
+#include "clang/Basic/SourceManager.h"
+#include "clang/Frontend/CompilerInstance.h"
+#include "clang/Frontend/FrontendOptions.h"
+#include "clang/Lex/HeaderSearch.h"
+#include "SymbolIndex.h"
+#include <ostream>
+#include <string>
+#include <vector>
+
+/**
+ * #include directive found by lexing a main source file without
+ * preprocessing it.
+ */
+struct ScreenedInclude
+{
+  /** location of the directive in the form file:line:column */
+  std::string location_;
+
+  /** header file name as it appears in the source */
+  std::string fileName_;
+
+  bool angled_;
+
+  /** true if the symbol index has a current entry for the header */
+  bool indexed_;
+
+  ScreenedInclude ():
+    angled_(false),
+    indexed_(false)
+  { }
+
+  /**
+   * Outputs warning message marking the verdict as heuristic.
+   */
+  void report(std::ostream& out) const;
+};
+
+/**
+ * Decides without parsing which #include directives of a main source file
+ * are probably used.  The main source file is lexed raw, and a directive is
+ * cleared if an identifier in the main source file is the name of a
+ * namespace scope symbol or macro which the symbol index records for the
+ * header and the entry is current.  A main source file whose directives are
+ * all cleared probably uses every header it includes, so the full analysis
+ * is needed only for the other main source files.
+ */
+class FastScreen
+{
+  const clang::LangOptions& langOptions_;
+  const SymbolIndex& symbolIndex_;
+  clang::FileManager fileManager_;
+  clang::SourceManager sourceManager_;
+  clang::HeaderSearch headerSearch_;
+
+  bool isCleared(
+      ScreenedInclude& include,
+      const clang::FileEntry* pMainFile,
+      const SymbolIndex::Symbols& identifiers);
+
+public:
+  /**
+   * Searches for headers as configured in the compiler instance.
+   */
+  FastScreen(clang::CompilerInstance& compiler, const SymbolIndex& symbolIndex);
+
+  /**
+   * Finds the #include directives of the main source file which could not
+   * be cleared.
+   *
+   * @return false if the main source file could not be read
+   */
+  bool screen(
+      const clang::FrontendInputFile& input,
+      std::vector<ScreenedInclude>& uncleared);
+};
+
+#endif
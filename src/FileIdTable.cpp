@@ -0,0 +1,29 @@
+#include "FileIdTable.h"
+#include "PathUtil.h"
+#include "llvm/Support/MutexGuard.h"
+
+using namespace llvm;
+
+unsigned
+FileIdTable::getId (StringRef fileName)
+{
+  std::string name(normalizePath(fileName));
+
+  MutexGuard guard(mutex_);
+  NameToIdMap::iterator pPair = nameToIdMap_.find(name);
+  if (pPair != nameToIdMap_.end()) {
+    return pPair->getValue();
+  }
+
+  unsigned id = names_.size();
+  nameToIdMap_[name] = id;
+  names_.push_back(name);
+  return id;
+}
+
+std::string
+FileIdTable::getName (unsigned id)
+{
+  MutexGuard guard(mutex_);
+  return names_[id];
+}
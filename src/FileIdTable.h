@@ -0,0 +1,35 @@
+#ifndef FILEIDTABLE_H
+#define FILEIDTABLE_H
+
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/Mutex.h"
+#include <string>
+#include <vector>
+
+/**
+ * Assigns a small integer ID to each file, so files can be compared without
+ * comparing path text.  File names are normalized with normalizePath, so
+ * different spellings of the same path get the same ID.  Safe to use from
+ * multiple threads.
+ */
+class FileIdTable
+{
+  typedef llvm::StringMap<unsigned> NameToIdMap;
+  NameToIdMap nameToIdMap_;
+  std::vector<std::string> names_;
+  llvm::sys::Mutex mutex_;
+
+public:
+  /**
+   * Gets ID of the file, assigning a new ID if the file has not been seen.
+   */
+  unsigned getId(llvm::StringRef fileName);
+
+  /**
+   * Gets normalized name of the file having the ID.
+   */
+  std::string getName(unsigned id);
+};
+
+#endif
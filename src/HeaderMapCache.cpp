@@ -0,0 +1,375 @@
+#include "HeaderMapCache.h"
+#include "clang/Basic/FileManager.h"
+#include "clang/Basic/FileSystemStatCache.h"
+#include "clang/Lex/HeaderSearchOptions.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/Support/DataTypes.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MutexGuard.h"
+#include "llvm/Support/Path.h"
+#include "PathUtil.h"
+#include "SymbolIndex.h"
+#include <algorithm>
+#include <cctype>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <vector>
+#include <sys/stat.h>
+
+using namespace clang;
+using namespace llvm;
+
+namespace {
+
+// First line of an index file.  The second line is the absolute path of the
+// include directory.  Each following line records an entry relative to the
+// include directory.  A directory whose entries were all recorded has a line
+// giving "D", its modification time in nanoseconds and its name separated by
+// tabs.  Any other entry has a line giving "F" and its name separated by a
+// tab.
+const char* const INDEX_SIGNATURE = "find-unnecessary-includes header map 2";
+
+const uint64_t NANOSECONDS_PER_SECOND = 1000000000;
+
+// Nanoseconds a directory must have been left unmodified before its index is
+// written.  File systems update modification times in ticks, as coarse as 2
+// seconds on FAT, and a directory modified again in the same tick keeps its
+// modification time.
+const uint64_t SETTLE_TIME = 2 * NANOSECONDS_PER_SECOND;
+
+// Directories nested deeper under an include directory are not indexed.  The
+// limit also stops a cycle of symbolic links.
+const unsigned MAX_DEPTH = 8;
+
+struct IndexEntry
+{
+  // path relative to the include directory, empty for the include directory
+  std::string name_;
+
+  // true if this is a directory whose entries were all recorded
+  bool directory_;
+
+  // modification time of the directory in nanoseconds
+  uint64_t modified_;
+
+  IndexEntry ():
+    directory_(false),
+    modified_(0)
+  { }
+};
+
+typedef std::vector<IndexEntry> IndexEntries;
+
+/**
+ * Converts a path to the form probes are looked up by.
+ */
+std::string
+makeKey (StringRef path)
+{
+  std::string key(path.str());
+#ifdef _WIN32
+  std::replace(key.begin(), key.end(), '\\', '/');
+#endif
+#if defined(_WIN32) || defined(__APPLE__)
+  // The file system is usually case-insensitive.
+  std::transform(key.begin(), key.end(), key.begin(), ::tolower);
+#endif
+  return key;
+}
+
+std::string
+joinPath (const std::string& directory, const std::string& name)
+{
+  if (directory.empty()) {
+    return name;
+  }
+  return name.empty() ? directory : directory + '/' + name;
+}
+
+/**
+ * Gets the modification time of a file in nanoseconds, at the resolution the
+ * platform reports.
+ */
+bool
+getModificationTime (const std::string& path, uint64_t& modified)
+{
+  struct stat status;
+  if (::stat(path.c_str(), &status) != 0) {
+    return false;
+  }
+#if defined(__APPLE__)
+  modified = uint64_t(status.st_mtimespec.tv_sec) * NANOSECONDS_PER_SECOND
+      + status.st_mtimespec.tv_nsec;
+#elif defined(_WIN32)
+  modified = uint64_t(status.st_mtime) * NANOSECONDS_PER_SECOND;
+#else
+  modified = uint64_t(status.st_mtim.tv_sec) * NANOSECONDS_PER_SECOND
+      + status.st_mtim.tv_nsec;
+#endif
+  return true;
+}
+
+/**
+ * Checks if every indexed directory was last modified long enough ago that a
+ * later modification will change its modification time.
+ */
+bool
+isSettled (const IndexEntries& entries)
+{
+  uint64_t now = uint64_t(std::time(0)) * NANOSECONDS_PER_SECOND;
+  for (IndexEntries::const_iterator pEntry = entries.begin();
+      pEntry != entries.end();
+      ++pEntry)
+  {
+    if (pEntry->directory_ && pEntry->modified_ + SETTLE_TIME > now) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/**
+ * Records a directory and, recursively, its entries.
+ */
+void
+enumerate (
+    const std::string& root,
+    const std::string& name,
+    unsigned depth,
+    IndexEntries& entries)
+{
+  IndexEntry entry;
+  entry.name_ = name;
+  std::string path(joinPath(root, name));
+
+  // Get the modification time before reading the entries, so a change made
+  // while reading them invalidates the index next time.
+  if (depth > MAX_DEPTH || !getModificationTime(path, entry.modified_)) {
+    entries.push_back(entry);
+    return;
+  }
+
+  std::size_t index = entries.size();
+  entries.push_back(entry);
+
+  error_code error;
+  for (sys::fs::directory_iterator pChild(path, error);
+      !error && pChild != sys::fs::directory_iterator();
+      pChild.increment(error))
+  {
+    std::string childName(
+        joinPath(name, sys::path::filename(pChild->path()).str()));
+    if (childName.find('\n') != std::string::npos) {
+      // An #include directive cannot name the file.
+      continue;
+    }
+
+    sys::fs::file_status status;
+    if (!pChild->status(status) && sys::fs::is_directory(status)) {
+      enumerate(root, childName, depth + 1, entries);
+    } else {
+      IndexEntry child;
+      child.name_ = childName;
+      entries.push_back(child);
+    }
+  }
+  entries[index].directory_ = !error;
+}
+
+/**
+ * Reads the index of an include directory.
+ *
+ * @return false if the index is missing, corrupt or stale
+ */
+bool
+loadIndex (
+    const std::string& path,
+    const std::string& absoluteRoot,
+    IndexEntries& entries)
+{
+  std::ifstream in(path.c_str());
+  std::string line;
+  if (!std::getline(in, line) || line != INDEX_SIGNATURE
+   || !std::getline(in, line) || line != absoluteRoot)
+  {
+    return false;
+  }
+
+  bool haveRoot = false;
+  while (std::getline(in, line)) {
+    IndexEntry entry;
+    if (line.compare(0, 2, "D\t") == 0) {
+      std::string::size_type tab = line.find('\t', 2);
+      if (tab == std::string::npos) {
+        return false;
+      }
+
+      std::istringstream modifiedIn(line.substr(2, tab - 2));
+      modifiedIn >> entry.modified_;
+      entry.name_ = line.substr(tab + 1);
+      entry.directory_ = true;
+
+      uint64_t modified;
+      if (!getModificationTime(joinPath(absoluteRoot, entry.name_), modified)
+       || modified != entry.modified_)
+      {
+        return false;
+      }
+      haveRoot = haveRoot || entry.name_.empty();
+    } else if (line.compare(0, 2, "F\t") == 0) {
+      entry.name_ = line.substr(2);
+    } else {
+      return false;
+    }
+    entries.push_back(entry);
+  }
+
+  return haveRoot && !in.bad();
+}
+
+/**
+ * @return false if the file could not be written
+ */
+bool
+saveIndex (
+    const std::string& path,
+    const std::string& absoluteRoot,
+    const IndexEntries& entries)
+{
+  std::ofstream out(path.c_str());
+  out << INDEX_SIGNATURE << '\n' << absoluteRoot << '\n';
+  for (IndexEntries::const_iterator pEntry = entries.begin();
+      pEntry != entries.end();
+      ++pEntry)
+  {
+    if (pEntry->directory_) {
+      out << "D\t" << pEntry->modified_ << '\t' << pEntry->name_ << '\n';
+    } else {
+      out << "F\t" << pEntry->name_ << '\n';
+    }
+  }
+
+  out.close();
+  return !out.fail();
+}
+
+}//namespace
+
+/**
+ * Adapts the index to the interface of the file manager, which takes
+ * ownership of it.
+ */
+class HeaderMapStatCache: public FileSystemStatCache
+{
+  HeaderMapCache& cache_;
+
+public:
+  HeaderMapStatCache (HeaderMapCache& cache):
+    cache_(cache)
+  { }
+
+  virtual LookupResult getStat(
+      const char* path, struct stat& status, int* pFileDescriptor);
+};
+
+FileSystemStatCache::LookupResult
+HeaderMapStatCache::getStat (
+    const char* path, struct stat& status, int* pFileDescriptor)
+{
+  if (cache_.isMissing(path)) {
+    return CacheMissing;
+  }
+  return statChained(path, status, pFileDescriptor);
+}
+
+void
+HeaderMapCache::index (const std::string& root)
+{
+  std::string absoluteRoot(normalizePath(root));
+  std::ostringstream fileName;
+  fileName << std::hex << SymbolIndex::hashContents(absoluteRoot) << ".hmap";
+  SmallString<128> path(cacheDir_);
+  sys::path::append(path, fileName.str());
+
+  IndexEntries entries;
+  if (!loadIndex(path.str(), absoluteRoot, entries)) {
+    entries.clear();
+    enumerate(absoluteRoot, std::string(), 0, entries);
+
+    // Don't keep the index of a directory which could not be read, or of
+    // directories modified too recently to detect the next change.  The
+    // index is still used for this run.
+    bool existed;
+    if (entries.front().directory_
+     && isSettled(entries)
+     && (sys::fs::create_directories(cacheDir_, existed)
+      || !saveIndex(path.str(), absoluteRoot, entries)))
+    {
+      std::cerr << "warning: cannot write " << path.str().str() << std::endl;
+    }
+  }
+
+  for (IndexEntries::iterator pEntry = entries.begin();
+      pEntry != entries.end();
+      ++pEntry)
+  {
+    std::string key(makeKey(joinPath(root, pEntry->name_)));
+    entries_.insert(key);
+    if (pEntry->directory_) {
+      directories_.insert(key);
+    }
+  }
+}
+
+bool
+HeaderMapCache::isMissing (StringRef path)
+{
+  // A path is known to be missing only if its directory was indexed.
+  std::string key(makeKey(path));
+  std::string::size_type slash = key.rfind('/');
+  if (slash == std::string::npos) {
+    return false;
+  }
+
+  MutexGuard guard(mutex_);
+  return directories_.count(key.substr(0, slash)) != 0
+      && entries_.count(key) == 0;
+}
+
+void
+HeaderMapCache::attach (CompilerInstance& compiler)
+{
+  const HeaderSearchOptions& options = compiler.getHeaderSearchOpts();
+  {
+    MutexGuard guard(mutex_);
+    for (std::vector<HeaderSearchOptions::Entry>::const_iterator pEntry =
+            options.UserEntries.begin();
+        pEntry != options.UserEntries.end();
+        ++pEntry)
+    {
+      if (pEntry->IsFramework
+       || (pEntry->Group != frontend::Angled
+        && pEntry->Group != frontend::Quoted))
+      {
+        continue;
+      }
+
+      // Header search names files in the directory without the trailing
+      // separator.
+      StringRef root(pEntry->Path);
+      while (root.size() > 1 && sys::path::is_separator(root.back())) {
+        root = root.substr(0, root.size() - 1);
+      }
+      if (!root.empty() && indexedRoots_.insert(root)) {
+        index(root.str());
+      }
+    }
+  }
+
+  if (!compiler.hasFileManager()) {
+    compiler.createFileManager();
+  }
+  compiler.getFileManager().addStatCache(new HeaderMapStatCache(*this));
+}
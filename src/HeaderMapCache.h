@@ -0,0 +1,59 @@
+#ifndef HEADERMAPCACHE_H
+#define HEADERMAPCACHE_H
+
+#include "clang/Frontend/CompilerInstance.h"
+#include "llvm/ADT/StringSet.h"
+#include "llvm/Support/Mutex.h"
+#include <string>
+
+/**
+ * Index of the files under the include directories given by -I and -iquote
+ * options, kept in a cache directory across runs.  Header search probes each
+ * include directory in turn for each #include directive.  With the index, a
+ * probe for a path which does not exist in an indexed directory is answered
+ * without accessing the file system, while a probe which finds a file still
+ * gets its status from the file system.  Because only the answers to probes
+ * change, header search finds the same files in the same order as without
+ * the index, including for #include_next.
+ *
+ * The index of an include directory is rebuilt when the modification time of
+ * any directory under it has changed since the index was written.  Times are
+ * compared in nanoseconds, and an index is not written while a directory was
+ * modified within the last couple of seconds, because a file system may not
+ * change the modification time of a directory modified again in the same
+ * tick.  Compiler instances on different threads may share the cache.
+ */
+class HeaderMapCache
+{
+  friend class HeaderMapStatCache;
+
+  std::string cacheDir_;
+
+  // include directories already indexed, as spelled in the options
+  llvm::StringSet<> indexedRoots_;
+
+  // directories whose entries were all recorded
+  llvm::StringSet<> directories_;
+
+  // files and directories found in the indexed directories
+  llvm::StringSet<> entries_;
+
+  llvm::sys::Mutex mutex_;
+
+  void index(const std::string& root);
+
+  bool isMissing(llvm::StringRef path);
+
+public:
+  HeaderMapCache (const std::string& cacheDir):
+    cacheDir_(cacheDir)
+  { }
+
+  /**
+   * Indexes the include directories of the compiler instance, and makes it
+   * answer probes from the index.  Call before executing an action.
+   */
+  void attach(clang::CompilerInstance& compiler);
+};
+
+#endif
@@ -0,0 +1,325 @@
+#include "IncludeGraph.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Support/system_error.h"
+#include "PathUtil.h"
+#include <algorithm>
+#include <set>
+#include <utility>
+
+using namespace llvm;
+using namespace include_graph;
+
+namespace {
+
+/**
+ * Orders provisional file IDs by file name.
+ */
+class NameLess
+{
+  const std::vector<std::string>& names_;
+
+public:
+  NameLess (const std::vector<std::string>& names):
+    names_(names)
+  { }
+
+  bool operator() (uint32_t left, uint32_t right) const
+  { return names_[left] < names_[right]; }
+};
+
+void
+writeWord (raw_ostream& out, uint32_t word)
+{
+  out.write(reinterpret_cast<const char*>(&word), sizeof(word));
+}
+
+void
+writePadding (raw_ostream& out, std::size_t size)
+{
+  for (; size % 4 != 0; ++size) {
+    out << '\0';
+  }
+}
+
+}//namespace
+
+uint32_t
+IncludeGraphWriter::intern (StringRef fileName)
+{
+  std::string name(normalizePath(fileName));
+  NameToIdMap::iterator pPair = nameToIdMap_.find(name);
+  if (pPair != nameToIdMap_.end()) {
+    return pPair->getValue();
+  }
+
+  uint32_t id = names_.size();
+  nameToIdMap_[name] = id;
+  names_.push_back(name);
+  return id;
+}
+
+void
+IncludeGraphWriter::addTranslationUnit (SourceFile::Ptr pMainSource)
+{
+  translationUnits_.push_back(TranslationUnit());
+  TranslationUnit& translationUnit = translationUnits_.back();
+  translationUnit.mainFile_ = intern(pMainSource->name());
+
+  // Walk the include graph breadth first, visiting each file once.
+  std::set<std::pair<uint32_t, uint32_t> > edges;
+  std::set<uint32_t> visited;
+  std::vector<SourceFile::Ptr> pending;
+  pending.push_back(pMainSource);
+  visited.insert(translationUnit.mainFile_);
+
+  for (std::size_t i = 0; i < pending.size(); ++i) {
+    SourceFile::Ptr pSource(pending[i]);
+    uint32_t from = intern(pSource->name());
+
+    for (SourceFile::IncludeDirectives::iterator ppInclude =
+            pSource->includeDirectives_.begin();
+        ppInclude != pSource->includeDirectives_.end();
+        ++ppInclude)
+    {
+      SourceFile::Ptr pHeader((*ppInclude)->pHeader_);
+      if (!isFileName(pHeader->name())) {
+        // Modules are not files.
+        continue;
+      }
+
+      uint32_t to = intern(pHeader->name());
+      if (edges.insert(std::make_pair(from, to)).second) {
+        Edge edge = { from, to };
+        translationUnit.edges_.push_back(edge);
+      }
+
+      if (visited.insert(to).second) {
+        pending.push_back(pHeader);
+      }
+    }
+  }
+
+  for (UsedHeaders::iterator pName = pMainSource->usedHeaders_.begin();
+      pName != pMainSource->usedHeaders_.end();
+      ++pName)
+  {
+    if (isFileName(*pName)) {
+      translationUnit.usedFiles_.push_back(intern(*pName));
+    }
+  }
+}
+
+bool
+IncludeGraphWriter::write (const std::string& path, std::string& errorMessage)
+{
+  // Assign final file IDs in file name order.
+  std::vector<uint32_t> order(names_.size());
+  for (uint32_t i = 0; i < order.size(); ++i) {
+    order[i] = i;
+  }
+  std::sort(order.begin(), order.end(), NameLess(names_));
+
+  std::vector<uint32_t> finalId(names_.size());
+  for (uint32_t i = 0; i < order.size(); ++i) {
+    finalId[order[i]] = i;
+  }
+
+  std::vector<uint32_t> stringOffsets;
+  uint32_t stringDataSize = 0;
+  for (uint32_t i = 0; i < order.size(); ++i) {
+    stringOffsets.push_back(stringDataSize);
+    stringDataSize += names_[order[i]].size() + 1;
+  }
+  stringOffsets.push_back(stringDataSize);
+
+  uint32_t edgeCount = 0;
+  for (std::size_t i = 0; i < translationUnits_.size(); ++i) {
+    edgeCount += translationUnits_[i].edges_.size();
+  }
+
+  Header header;
+  header.magic = MAGIC;
+  header.version = VERSION;
+  header.stringCount = names_.size();
+  header.stringDataSize = stringDataSize;
+  header.translationUnitCount = translationUnits_.size();
+  header.edgeCount = edgeCount;
+  header.bitsetWords = (names_.size() + 31) / 32;
+  header.reserved = 0;
+
+  raw_fd_ostream out(path.c_str(), errorMessage, raw_fd_ostream::F_Binary);
+  if (!errorMessage.empty()) {
+    return false;
+  }
+
+  out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+  for (std::size_t i = 0; i < stringOffsets.size(); ++i) {
+    writeWord(out, stringOffsets[i]);
+  }
+  for (uint32_t i = 0; i < order.size(); ++i) {
+    const std::string& name = names_[order[i]];
+    out.write(name.c_str(), name.size() + 1);
+  }
+  writePadding(out, stringDataSize);
+
+  uint32_t firstEdge = 0;
+  for (std::size_t i = 0; i < translationUnits_.size(); ++i) {
+    const TranslationUnit& translationUnit = translationUnits_[i];
+    writeWord(out, finalId[translationUnit.mainFile_]);
+    writeWord(out, firstEdge);
+    writeWord(out, translationUnit.edges_.size());
+    firstEdge += translationUnit.edges_.size();
+  }
+
+  for (std::size_t i = 0; i < translationUnits_.size(); ++i) {
+    const std::vector<Edge>& edges = translationUnits_[i].edges_;
+    for (std::size_t j = 0; j < edges.size(); ++j) {
+      writeWord(out, finalId[edges[j].from]);
+      writeWord(out, finalId[edges[j].to]);
+    }
+  }
+
+  for (std::size_t i = 0; i < translationUnits_.size(); ++i) {
+    std::vector<uint32_t> bitset(header.bitsetWords);
+    const std::vector<uint32_t>& usedFiles = translationUnits_[i].usedFiles_;
+    for (std::size_t j = 0; j < usedFiles.size(); ++j) {
+      uint32_t file = finalId[usedFiles[j]];
+      bitset[file / 32] |= uint32_t(1) << (file % 32);
+    }
+
+    for (std::size_t j = 0; j < bitset.size(); ++j) {
+      writeWord(out, bitset[j]);
+    }
+  }
+
+  out.close();
+  if (out.has_error()) {
+    out.clear_error();
+    errorMessage = "cannot write " + path;
+    return false;
+  }
+  return true;
+}
+
+bool
+IncludeGraph::open (const std::string& path, std::string& errorMessage)
+{
+  error_code error = MemoryBuffer::getFile(path, pBuffer_, -1, false);
+  if (error) {
+    errorMessage = "cannot read " + path + ": " + error.message();
+    return false;
+  }
+
+  const char* data = pBuffer_->getBufferStart();
+  std::size_t size = pBuffer_->getBufferSize();
+  if (size < sizeof(Header)) {
+    errorMessage = path + " is not an include graph file";
+    return false;
+  }
+
+  // Keep the view closed until the whole file is validated.
+  pHeader_ = 0;
+  const Header* pHeader = reinterpret_cast<const Header*>(data);
+  if (pHeader->magic != MAGIC) {
+    errorMessage = path + " is not an include graph file";
+    return false;
+  }
+  if (pHeader->version != VERSION) {
+    errorMessage = path + " has unsupported include graph version";
+    return false;
+  }
+
+  // Compute section locations, using 64-bit arithmetic so a corrupt header
+  // cannot overflow the size check.
+  uint64_t offset = sizeof(Header);
+  uint64_t stringOffsetsOffset = offset;
+  offset += (uint64_t(pHeader->stringCount) + 1) * sizeof(uint32_t);
+  uint64_t stringDataOffset = offset;
+  offset += (uint64_t(pHeader->stringDataSize) + 3) & ~uint64_t(3);
+  uint64_t translationUnitsOffset = offset;
+  offset += uint64_t(pHeader->translationUnitCount) * sizeof(TranslationUnit);
+  uint64_t edgesOffset = offset;
+  offset += uint64_t(pHeader->edgeCount) * sizeof(Edge);
+  uint64_t usedBitsetsOffset = offset;
+  offset += uint64_t(pHeader->translationUnitCount)
+      * pHeader->bitsetWords * sizeof(uint32_t);
+  if (offset > size
+   || pHeader->bitsetWords != (uint64_t(pHeader->stringCount) + 31) / 32)
+  {
+    errorMessage = path + " is truncated or corrupt";
+    return false;
+  }
+
+  const uint32_t* stringOffsets = reinterpret_cast<const uint32_t*>(
+      data + stringOffsetsOffset);
+  const char* stringData = data + stringDataOffset;
+  const TranslationUnit* translationUnits =
+      reinterpret_cast<const TranslationUnit*>(data + translationUnitsOffset);
+  const Edge* edges = reinterpret_cast<const Edge*>(data + edgesOffset);
+
+  // Each file name ends with a null inside the string data.
+  if (stringOffsets[0] != 0
+   || stringOffsets[pHeader->stringCount] != pHeader->stringDataSize)
+  {
+    errorMessage = path + " is truncated or corrupt";
+    return false;
+  }
+  for (uint32_t i = 0; i < pHeader->stringCount; ++i) {
+    if (stringOffsets[i] >= stringOffsets[i + 1]
+     || stringData[stringOffsets[i + 1] - 1] != '\0')
+    {
+      errorMessage = path + " is truncated or corrupt";
+      return false;
+    }
+  }
+
+  for (uint32_t i = 0; i < pHeader->translationUnitCount; ++i) {
+    const TranslationUnit& translationUnit = translationUnits[i];
+    if (translationUnit.mainFile >= pHeader->stringCount
+     || uint64_t(translationUnit.firstEdge) + translationUnit.edgeCount
+            > pHeader->edgeCount)
+    {
+      errorMessage = path + " is truncated or corrupt";
+      return false;
+    }
+  }
+
+  for (uint32_t i = 0; i < pHeader->edgeCount; ++i) {
+    if (edges[i].from >= pHeader->stringCount
+     || edges[i].to >= pHeader->stringCount)
+    {
+      errorMessage = path + " is truncated or corrupt";
+      return false;
+    }
+  }
+
+  pHeader_ = pHeader;
+  stringOffsets_ = stringOffsets;
+  stringData_ = stringData;
+  translationUnits_ = translationUnits;
+  edges_ = edges;
+  usedBitsets_ = reinterpret_cast<const uint32_t*>(data + usedBitsetsOffset);
+  return true;
+}
+
+uint32_t
+IncludeGraph::findFile (StringRef name) const
+{
+  uint32_t low = 0;
+  uint32_t high = fileCount();
+  while (low < high) {
+    uint32_t middle = low + (high - low) / 2;
+    int compare = fileName(middle).compare(name);
+    if (compare == 0) {
+      return middle;
+    }
+
+    if (compare < 0) {
+      low = middle + 1;
+    } else {
+      high = middle;
+    }
+  }
+  return NOT_FOUND;
+}
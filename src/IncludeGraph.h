@@ -0,0 +1,199 @@
+#ifndef INCLUDEGRAPH_H
+#define INCLUDEGRAPH_H
+
+#include "llvm/ADT/OwningPtr.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/DataTypes.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "UnnecessaryIncludeFinder.h"
+#include <cassert>
+#include <string>
+#include <vector>
+
+/**
+ * Binary include graph file format.  All fields are 32-bit words in the byte
+ * order of the machine that wrote the file, so a mismatched magic number also
+ * detects a foreign byte order.  Sections follow the header in this order,
+ * each aligned to 4 bytes:
+ *
+ *   uint32_t stringOffsets[stringCount + 1]
+ *   char stringData[stringDataSize]         null-terminated file names
+ *   TranslationUnit translationUnits[translationUnitCount]
+ *   Edge edges[edgeCount]
+ *   uint32_t usedBitsets[translationUnitCount * bitsetWords]
+ *
+ * File names are normalized with normalizePath, like in the reverse include
+ * index, and sorted so a name can be found by binary search.  File IDs are
+ * indexes into the string table.
+ */
+namespace include_graph {
+
+const uint32_t MAGIC = 0x47495546;  // "FUIG"
+const uint32_t VERSION = 2;
+
+struct Header
+{
+  uint32_t magic;
+  uint32_t version;
+  uint32_t stringCount;
+  uint32_t stringDataSize;
+  uint32_t translationUnitCount;
+  uint32_t edgeCount;
+  uint32_t bitsetWords;
+  uint32_t reserved;
+};
+
+struct TranslationUnit
+{
+  /** file ID of main source file */
+  uint32_t mainFile;
+
+  /** index of first #include edge of this translation unit */
+  uint32_t firstEdge;
+
+  /** number of #include edges of this translation unit */
+  uint32_t edgeCount;
+};
+
+/**
+ * File including another file.
+ */
+struct Edge
+{
+  uint32_t from;
+  uint32_t to;
+};
+
+}//namespace include_graph
+
+/**
+ * Writes the include graphs of analyzed translation units to a file.
+ */
+class IncludeGraphWriter
+{
+  // map file name to provisional file ID
+  typedef llvm::StringMap<uint32_t> NameToIdMap;
+  NameToIdMap nameToIdMap_;
+  std::vector<std::string> names_;
+
+  struct TranslationUnit
+  {
+    uint32_t mainFile_;
+    std::vector<include_graph::Edge> edges_;
+    std::vector<uint32_t> usedFiles_;
+  };
+  std::vector<TranslationUnit> translationUnits_;
+
+  uint32_t intern(llvm::StringRef fileName);
+
+public:
+  /**
+   * Adds the include graph and used headers of a main source file.
+   */
+  void addTranslationUnit(SourceFile::Ptr pMainSource);
+
+  /**
+   * @return false if the file could not be written
+   */
+  bool write(const std::string& path, std::string& errorMessage);
+};
+
+/**
+ * Read-only view of an include graph file.  The file is memory-mapped, so
+ * opening it costs little more than validating the string offsets, the
+ * translation units and the edges, after which every file ID and edge range
+ * in the file can be used without checking.
+ */
+class IncludeGraph
+{
+  llvm::OwningPtr<llvm::MemoryBuffer> pBuffer_;
+  const include_graph::Header* pHeader_;
+  const uint32_t* stringOffsets_;
+  const char* stringData_;
+  const include_graph::TranslationUnit* translationUnits_;
+  const include_graph::Edge* edges_;
+  const uint32_t* usedBitsets_;
+
+public:
+  typedef const include_graph::Edge* EdgeIterator;
+
+  /** returned by findFile if the file is not in the graph */
+  static const uint32_t NOT_FOUND = ~uint32_t(0);
+
+  IncludeGraph ():
+    pHeader_(0),
+    stringOffsets_(0),
+    stringData_(0),
+    translationUnits_(0),
+    edges_(0),
+    usedBitsets_(0)
+  { }
+
+  /**
+   * Maps the file into memory.  The other member functions must not be
+   * called unless this succeeded.
+   *
+   * @return false if the file could not be read or is not a valid include
+   *         graph file
+   */
+  bool open(const std::string& path, std::string& errorMessage);
+
+  uint32_t fileCount () const
+  {
+    assert(pHeader_ != 0);
+    return pHeader_->stringCount;
+  }
+
+  llvm::StringRef fileName (uint32_t file) const
+  {
+    assert(file < fileCount());
+    return llvm::StringRef(
+        stringData_ + stringOffsets_[file],
+        stringOffsets_[file + 1] - stringOffsets_[file] - 1);
+  }
+
+  /**
+   * Finds file ID by name, which must be normalized with normalizePath.
+   *
+   * @return NOT_FOUND if the file is not in the graph
+   */
+  uint32_t findFile(llvm::StringRef name) const;
+
+  uint32_t translationUnitCount () const
+  {
+    assert(pHeader_ != 0);
+    return pHeader_->translationUnitCount;
+  }
+
+  uint32_t mainFile (uint32_t translationUnit) const
+  {
+    assert(translationUnit < translationUnitCount());
+    return translationUnits_[translationUnit].mainFile;
+  }
+
+  EdgeIterator edgesBegin (uint32_t translationUnit) const
+  {
+    assert(translationUnit < translationUnitCount());
+    return edges_ + translationUnits_[translationUnit].firstEdge;
+  }
+
+  EdgeIterator edgesEnd (uint32_t translationUnit) const
+  {
+    return edgesBegin(translationUnit)
+        + translationUnits_[translationUnit].edgeCount;
+  }
+
+  /**
+   * Checks if the main source file of the translation unit uses a file.
+   */
+  bool isUsed (uint32_t translationUnit, uint32_t file) const
+  {
+    assert(translationUnit < translationUnitCount() && file < fileCount());
+    const uint32_t* bitset =
+        usedBitsets_ + translationUnit * pHeader_->bitsetWords;
+    return (bitset[file / 32] >> (file % 32)) & 1;
+  }
+};
+
+#endif
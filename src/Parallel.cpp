@@ -0,0 +1,155 @@
+#include "Parallel.h"
+#include "llvm/Support/Mutex.h"
+#include "llvm/Support/MutexGuard.h"
+#include "llvm/Support/Threading.h"
+#include <vector>
+#ifdef _WIN32
+#include <windows.h>
+#include <process.h>
+#else
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
+using namespace llvm;
+
+namespace {
+
+// Parsing C++ recurses deeply, so give threads as much stack as the main
+// thread usually has.
+const unsigned THREAD_STACK_SIZE = 8 << 20;
+
+/**
+ * Hands out indexes to threads.
+ */
+class WorkQueue
+{
+  ParallelTask& task_;
+  unsigned count_;
+  unsigned next_;
+  sys::Mutex mutex_;
+
+  bool take (unsigned& index)
+  {
+    MutexGuard guard(mutex_);
+    if (next_ >= count_) {
+      return false;
+    }
+    index = next_++;
+    return true;
+  }
+
+public:
+  WorkQueue (ParallelTask& task, unsigned count):
+    task_(task),
+    count_(count),
+    next_(0)
+  { }
+
+  void runAll ()
+  {
+    unsigned index;
+    while (take(index)) {
+      task_.run(index);
+    }
+  }
+};
+
+#ifdef _WIN32
+typedef HANDLE Thread;
+
+unsigned __stdcall
+runWorker (void* pQueue)
+{
+  static_cast<WorkQueue*>(pQueue)->runAll();
+  return 0;
+}
+
+bool
+startThread (Thread& thread, WorkQueue& queue)
+{
+  thread = reinterpret_cast<HANDLE>(
+      _beginthreadex(0, THREAD_STACK_SIZE, runWorker, &queue, 0, 0));
+  return thread != 0;
+}
+
+void
+joinThread (Thread thread)
+{
+  WaitForSingleObject(thread, INFINITE);
+  CloseHandle(thread);
+}
+#else
+typedef pthread_t Thread;
+
+void*
+runWorker (void* pQueue)
+{
+  static_cast<WorkQueue*>(pQueue)->runAll();
+  return 0;
+}
+
+bool
+startThread (Thread& thread, WorkQueue& queue)
+{
+  pthread_attr_t attributes;
+  pthread_attr_init(&attributes);
+  pthread_attr_setstacksize(&attributes, THREAD_STACK_SIZE);
+  int error = pthread_create(&thread, &attributes, runWorker, &queue);
+  pthread_attr_destroy(&attributes);
+  return error == 0;
+}
+
+void
+joinThread (Thread thread)
+{
+  pthread_join(thread, 0);
+}
+#endif
+
+}//namespace
+
+void
+parallelFor (unsigned count, ParallelTask& task, unsigned threadCount)
+{
+  if (threadCount > count) {
+    threadCount = count;
+  }
+
+  if (threadCount > 1 && !llvm_is_multithreaded()) {
+    llvm_start_multithreaded();
+  }
+
+  WorkQueue queue(task, count);
+  std::vector<Thread> threads;
+  for (unsigned i = 1; i < threadCount; ++i) {
+    Thread thread;
+    if (!startThread(thread, queue)) {
+      // Carry on with the threads already started.
+      break;
+    }
+    threads.push_back(thread);
+  }
+
+  queue.runAll();
+
+  for (std::vector<Thread>::iterator pThread = threads.begin();
+      pThread != threads.end();
+      ++pThread)
+  {
+    joinThread(*pThread);
+  }
+}
+
+unsigned
+hardwareConcurrency ()
+{
+#ifdef _WIN32
+  SYSTEM_INFO systemInfo;
+  GetSystemInfo(&systemInfo);
+  return systemInfo.dwNumberOfProcessors;
+#else
+  long count = sysconf(_SC_NPROCESSORS_ONLN);
+  return (count > 0) ? static_cast<unsigned>(count) : 1;
+#endif
+}
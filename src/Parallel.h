@@ -0,0 +1,28 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+/**
+ * Work run by parallelFor for each index.
+ */
+class ParallelTask
+{
+public:
+  virtual ~ParallelTask ()
+  { }
+
+  virtual void run(unsigned index) = 0;
+};
+
+/**
+ * Runs the task for each index from 0 to count - 1 on up to threadCount
+ * threads, including the calling thread, and waits for all of them to finish.
+ * Indexes are handed out in increasing order as threads become free.
+ */
+void parallelFor(unsigned count, ParallelTask& task, unsigned threadCount);
+
+/**
+ * Gets number of processors available to run threads.
+ */
+unsigned hardwareConcurrency();
+
+#endif
@@ -0,0 +1,43 @@
+#include "PathUtil.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Path.h"
+#include <vector>
+
+using namespace llvm;
+
+std::string
+normalizePath (StringRef path)
+{
+  SmallString<256> absolute(path);
+  sys::fs::make_absolute(absolute);
+
+  StringRef relative = sys::path::relative_path(absolute);
+  std::vector<StringRef> components;
+  for (sys::path::const_iterator pComponent = sys::path::begin(relative);
+      pComponent != sys::path::end(relative);
+      ++pComponent)
+  {
+    if (*pComponent == ".") {
+      continue;
+    }
+
+    if (*pComponent == "..") {
+      if (!components.empty()) {
+        components.pop_back();
+      }
+      continue;
+    }
+
+    components.push_back(*pComponent);
+  }
+
+  SmallString<256> normalized(sys::path::root_path(absolute));
+  for (std::vector<StringRef>::iterator pComponent = components.begin();
+      pComponent != components.end();
+      ++pComponent)
+  {
+    sys::path::append(normalized, *pComponent);
+  }
+  return std::string(normalized.begin(), normalized.end());
+}
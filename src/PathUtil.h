@@ -0,0 +1,13 @@
+#ifndef PATHUTIL_H
+#define PATHUTIL_H
+
+#include "llvm/ADT/StringRef.h"
+#include <string>
+
+/**
+ * Converts a path to an absolute path without "." or ".." components, so
+ * different spellings of the same file compare equal.
+ */
+std::string normalizePath(llvm::StringRef path);
+
+#endif
@@ -0,0 +1,452 @@
+#include "Plan.h"
+#include "PathUtil.h"
+#include "clang/Basic/Diagnostic.h"
+#include "clang/Basic/DiagnosticOptions.h"
+#include "clang/Driver/Compilation.h"
+#include "clang/Driver/Driver.h"
+#include "clang/Driver/Job.h"
+#include "clang/Driver/Tool.h"
+#include "clang/Frontend/TextDiagnosticPrinter.h"
+#include "clang/Tooling/CompilationDatabase.h"
+#include "llvm/ADT/OwningPtr.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Host.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/raw_ostream.h"
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <set>
+#include <sstream>
+
+using namespace clang;
+using namespace llvm;
+
+namespace {
+
+// First line of a cost history file.  Each following line has the seconds
+// spent analyzing an input, a tab and the input name.
+const char* const HISTORY_SIGNATURE =
+    "find-unnecessary-includes cost history 1";
+
+// Options taking a path, either as a separate argument or joined to it.  An
+// option comes before any shorter option it starts with.
+const char* const PATH_OPTIONS[] = {
+  "-F",
+  "-I",
+  "-idirafter",
+  "-imacros",
+  "-include-pch",
+  "-include",
+  "-iquote",
+  "-isysroot",
+  "-isystem"
+};
+
+// Options naming dependency files, taking a separate value.
+const char* const DEPENDENCY_OPTIONS[] = {
+  "-MF",
+  "-MQ",
+  "-MT"
+};
+
+template<typename T, std::size_t N>
+std::size_t
+countOf (T (&)[N])
+{
+  return N;
+}
+
+bool
+isListed (const char* const options[], std::size_t count, StringRef arg)
+{
+  for (std::size_t i = 0; i < count; ++i) {
+    if (arg == options[i]) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/**
+ * Gets the option taking a path which the argument starts with.
+ *
+ * @return null if there is none
+ */
+const char*
+findPathOption (StringRef arg)
+{
+  for (std::size_t i = 0; i < countOf(PATH_OPTIONS); ++i) {
+    if (arg.startswith(PATH_OPTIONS[i])) {
+      return PATH_OPTIONS[i];
+    }
+  }
+  return 0;
+}
+
+std::string
+makeAbsolute (const std::string& directory, StringRef path)
+{
+  if (sys::path::is_absolute(path)) {
+    return normalizePath(path);
+  }
+
+  SmallString<256> joined(directory);
+  sys::path::append(joined, path);
+  return normalizePath(joined.str());
+}
+
+/**
+ * Copies the arguments of a compiler command line, except the compiler, the
+ * input and options producing output or dependency files, with paths made
+ * absolute.  The copied arguments other than warning and debug information
+ * options form the key identifying equivalent commands.
+ */
+void
+normalizeCommand (
+    const tooling::CompileCommand& command,
+    const std::string& input,
+    std::vector<std::string>& args,
+    std::vector<std::string>& key)
+{
+  const std::vector<std::string>& commandLine = command.CommandLine;
+
+  // Skip the compiler.
+  for (std::size_t i = 1; i < commandLine.size(); ++i) {
+    StringRef arg(commandLine[i]);
+    bool haveNext = i + 1 < commandLine.size();
+
+    if (arg == "-o" || isListed(
+        DEPENDENCY_OPTIONS, countOf(DEPENDENCY_OPTIONS), arg))
+    {
+      ++i;
+      continue;
+    }
+    if (arg == "-c" || arg.startswith("-o") || arg.startswith("-M")
+     || (!arg.startswith("-") && makeAbsolute(command.Directory, arg) == input))
+    {
+      continue;
+    }
+
+    std::vector<std::string> normalized;
+    const char* pathOption = findPathOption(arg);
+    if (pathOption != 0 && arg == pathOption) {
+      if (haveNext) {
+        normalized.push_back(arg.str());
+        normalized.push_back(makeAbsolute(command.Directory, commandLine[++i]));
+      }
+    } else if (pathOption != 0) {
+      StringRef path(arg.substr(StringRef(pathOption).size()));
+      normalized.push_back(pathOption + makeAbsolute(command.Directory, path));
+    } else if (arg.startswith("--sysroot=")) {
+      StringRef path(arg.substr(StringRef("--sysroot=").size()));
+      normalized.push_back(
+          "--sysroot=" + makeAbsolute(command.Directory, path));
+    } else {
+      normalized.push_back(arg.str());
+    }
+
+    args.insert(args.end(), normalized.begin(), normalized.end());
+    if (!arg.startswith("-W") && !arg.startswith("-g")) {
+      key.insert(key.end(), normalized.begin(), normalized.end());
+    }
+  }
+}
+
+/**
+ * Converts a compiler command line to the options of the compiler front end
+ * for only parsing the input.  The driver derives the builtin include paths
+ * from the resource directory of this program, not of the compiler, so they
+ * match the resource directory this program sets.
+ *
+ * @return false if the command line is not understood
+ */
+bool
+getFrontEndArguments (
+    const std::string& compiler,
+    const std::string& resourceDir,
+    const std::vector<std::string>& driverArgs,
+    const std::string& input,
+    std::vector<std::string>& args)
+{
+  std::vector<const char*> argv;
+  argv.push_back(compiler.c_str());
+  for (std::vector<std::string>::const_iterator pArg = driverArgs.begin();
+      pArg != driverArgs.end();
+      ++pArg)
+  {
+    argv.push_back(pArg->c_str());
+  }
+  argv.push_back("-fsyntax-only");
+  argv.push_back(input.c_str());
+
+  IntrusiveRefCntPtr<DiagnosticOptions> pDiagnosticOptions(
+      new DiagnosticOptions);
+  TextDiagnosticPrinter printer(errs(), &*pDiagnosticOptions);
+  DiagnosticsEngine diagnostics(
+      IntrusiveRefCntPtr<DiagnosticIDs>(new DiagnosticIDs),
+      &*pDiagnosticOptions,
+      &printer,
+      false);
+
+  driver::Driver driver(
+      compiler, sys::getDefaultTargetTriple(), "a.out", false, diagnostics);
+  driver.CCCIsCXX =
+      sys::path::filename(compiler).find("++") != StringRef::npos;
+  if (!resourceDir.empty()) {
+    driver.ResourceDir = resourceDir;
+  }
+  OwningPtr<driver::Compilation> pCompilation(
+      driver.BuildCompilation(argv));
+  if (!pCompilation || diagnostics.hasErrorOccurred()) {
+    return false;
+  }
+
+  // Expect a single invocation of the clang front end.
+  const driver::JobList& jobs = pCompilation->getJobs();
+  if (jobs.size() != 1 || !isa<driver::Command>(*jobs.begin())) {
+    return false;
+  }
+  const driver::Command* pCommand = cast<driver::Command>(*jobs.begin());
+  if (StringRef(pCommand->getCreator().getName()) != "clang") {
+    return false;
+  }
+
+  // Skip -cc1.
+  const driver::ArgStringList& frontEndArgs = pCommand->getArguments();
+  for (std::size_t i = 1; i < frontEndArgs.size(); ++i) {
+    StringRef arg(frontEndArgs[i]);
+    if (arg == "-resource-dir" || arg == "-main-file-name" || arg == "-o") {
+      ++i;
+      continue;
+    }
+    args.push_back(arg.str());
+  }
+  return true;
+}
+
+/**
+ * Orders indexes of inputs by descending cost.
+ */
+class MoreCostlyInput
+{
+  const PlannedInputs& inputs_;
+
+public:
+  MoreCostlyInput (const PlannedInputs& inputs):
+    inputs_(inputs)
+  { }
+
+  bool operator() (std::size_t left, std::size_t right) const
+  { return inputs_[left].cost_ > inputs_[right].cost_; }
+};
+
+}//namespace
+
+bool
+CostHistory::load (const std::string& path, std::string& errorMessage)
+{
+  bool exists;
+  if (sys::fs::exists(path, exists) || !exists) {
+    return true;
+  }
+
+  std::ifstream in(path.c_str());
+  std::string line;
+  if (!std::getline(in, line) || line != HISTORY_SIGNATURE) {
+    errorMessage = path + " is not a cost history file";
+    return false;
+  }
+
+  while (std::getline(in, line)) {
+    std::string::size_type tab = line.find('\t');
+    if (tab == std::string::npos) {
+      continue;
+    }
+
+    std::istringstream seconds(line.substr(0, tab));
+    double value;
+    if (seconds >> value) {
+      inputToSecondsMap_[line.substr(tab + 1)] = value;
+    }
+  }
+
+  if (in.bad()) {
+    errorMessage = "cannot read " + path;
+    return false;
+  }
+  return true;
+}
+
+bool
+CostHistory::save (const std::string& path, std::string& errorMessage) const
+{
+  std::ofstream out(path.c_str());
+  out << HISTORY_SIGNATURE << '\n';
+  for (InputToSecondsMap::const_iterator pPair = inputToSecondsMap_.begin();
+      pPair != inputToSecondsMap_.end();
+      ++pPair)
+  {
+    out << pPair->second << '\t' << pPair->first << '\n';
+  }
+
+  out.close();
+  if (!out) {
+    errorMessage = "cannot write " + path;
+    return false;
+  }
+  return true;
+}
+
+void
+CostHistory::record (const std::string& input, double seconds)
+{
+  inputToSecondsMap_[input] = seconds;
+}
+
+bool
+CostHistory::lookup (const std::string& input, double& seconds) const
+{
+  InputToSecondsMap::const_iterator pPair = inputToSecondsMap_.find(input);
+  if (pPair == inputToSecondsMap_.end()) {
+    return false;
+  }
+
+  seconds = pPair->second;
+  return true;
+}
+
+bool
+loadCompileCommands (
+    const std::string& buildDirectory,
+    const std::string& resourceDir,
+    PlannedInputs& inputs,
+    std::string& errorMessage)
+{
+  OwningPtr<tooling::CompilationDatabase> pDatabase(
+      tooling::CompilationDatabase::loadFromDirectory(
+          buildDirectory, errorMessage));
+  if (!pDatabase) {
+    return false;
+  }
+
+  std::vector<std::string> files = pDatabase->getAllFiles();
+  for (std::vector<std::string>::iterator pFile = files.begin();
+      pFile != files.end();
+      ++pFile)
+  {
+    std::vector<tooling::CompileCommand> commands =
+        pDatabase->getCompileCommands(*pFile);
+    for (std::vector<tooling::CompileCommand>::iterator pCommand =
+            commands.begin();
+        pCommand != commands.end();
+        ++pCommand)
+    {
+      StringRef extension = sys::path::extension(*pFile);
+      InputKind kind = extension.empty()
+          ? IK_None
+          : FrontendOptions::getInputKindForExtension(extension.substr(1));
+      if (kind == IK_None) {
+        kind = IK_CXX;
+      }
+
+      std::string path(makeAbsolute(pCommand->Directory, *pFile));
+      PlannedInput input(FrontendInputFile(path, kind));
+      std::vector<std::string> driverArgs;
+      normalizeCommand(*pCommand, path, driverArgs, input.key_);
+      if (pCommand->CommandLine.empty()
+       || !getFrontEndArguments(
+              pCommand->CommandLine[0],
+              resourceDir,
+              driverArgs,
+              path,
+              input.args_))
+      {
+        std::cerr << "error: cannot interpret compile command for " << path
+            << std::endl;
+        continue;
+      }
+      inputs.push_back(input);
+    }
+  }
+  return true;
+}
+
+std::size_t
+removeEquivalentInputs (PlannedInputs& inputs)
+{
+  std::set<std::string> seen;
+  PlannedInputs kept;
+  for (PlannedInputs::iterator pInput = inputs.begin();
+      pInput != inputs.end();
+      ++pInput)
+  {
+    std::string key(normalizePath(pInput->input_.getFile()));
+    for (std::vector<std::string>::iterator pArg = pInput->key_.begin();
+        pArg != pInput->key_.end();
+        ++pArg)
+    {
+      key += '\n';
+      key += *pArg;
+    }
+
+    if (seen.insert(key).second) {
+      kept.push_back(*pInput);
+    }
+  }
+
+  std::size_t removed = inputs.size() - kept.size();
+  inputs.swap(kept);
+  return removed;
+}
+
+void
+estimateCosts (PlannedInputs& inputs, const CostHistory& history)
+{
+  std::vector<uint64_t> sizes(inputs.size());
+  std::vector<bool> recorded(inputs.size());
+  std::vector<double> secondsPerByte;
+  for (std::size_t i = 0; i < inputs.size(); ++i) {
+    std::string name(normalizePath(inputs[i].input_.getFile()));
+    if (sys::fs::file_size(name, sizes[i])) {
+      sizes[i] = 0;
+    }
+
+    double seconds;
+    if (history.lookup(name, seconds)) {
+      recorded[i] = true;
+      inputs[i].cost_ = seconds;
+      if (sizes[i] != 0) {
+        secondsPerByte.push_back(seconds / sizes[i]);
+      }
+    }
+  }
+
+  // Convert sizes to seconds by the median rate of the recorded inputs.
+  double scale = 1.0;
+  if (!secondsPerByte.empty()) {
+    std::vector<double>::iterator pMedian =
+        secondsPerByte.begin() + secondsPerByte.size() / 2;
+    std::nth_element(secondsPerByte.begin(), pMedian, secondsPerByte.end());
+    scale = *pMedian;
+  }
+
+  for (std::size_t i = 0; i < inputs.size(); ++i) {
+    if (!recorded[i]) {
+      inputs[i].cost_ = sizes[i] * scale;
+    }
+  }
+}
+
+std::vector<std::size_t>
+scheduleLargestFirst (const PlannedInputs& inputs)
+{
+  std::vector<std::size_t> order(inputs.size());
+  for (std::size_t i = 0; i < order.size(); ++i) {
+    order[i] = i;
+  }
+
+  std::stable_sort(order.begin(), order.end(), MoreCostlyInput(inputs));
+  return order;
+}
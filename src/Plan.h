@@ -0,0 +1,111 @@
+#ifndef PLAN_H
+#define PLAN_H
+
+#include "clang/Frontend/FrontendOptions.h"
+#include <map>
+#include <string>
+#include <vector>
+
+/**
+ * Input to analyze, with clang options specific to it.
+ */
+struct PlannedInput
+{
+  clang::FrontendInputFile input_;
+
+  /** clang options added to the command line options for this input */
+  std::vector<std::string> args_;
+
+  /**
+   * options of the build command determining the analysis results, with
+   * paths made absolute, used to find equivalent inputs
+   */
+  std::vector<std::string> key_;
+
+  /** estimated cost of analyzing the input, used only to order work */
+  double cost_;
+
+  PlannedInput (const clang::FrontendInputFile& input):
+    input_(input),
+    cost_(0.0)
+  { }
+};
+
+typedef std::vector<PlannedInput> PlannedInputs;
+
+/**
+ * Persistent record of seconds spent analyzing each input in earlier runs.
+ * Input names are normalized with normalizePath.
+ */
+class CostHistory
+{
+  typedef std::map<std::string, double> InputToSecondsMap;
+  InputToSecondsMap inputToSecondsMap_;
+
+public:
+  /**
+   * Reads the history from a file.  A missing file yields an empty history.
+   *
+   * @return false if the file exists but could not be read
+   */
+  bool load(const std::string& path, std::string& errorMessage);
+
+  /**
+   * @return false if the file could not be written
+   */
+  bool save(const std::string& path, std::string& errorMessage) const;
+
+  /**
+   * Replaces the seconds recorded for the input.
+   */
+  void record(const std::string& input, double seconds);
+
+  /**
+   * Gets the seconds recorded for the input.
+   *
+   * @return false if the input is not recorded
+   */
+  bool lookup(const std::string& input, double& seconds) const;
+};
+
+/**
+ * Reads the inputs and their options from the compile_commands.json file in
+ * the build directory.  Each input is analyzed with the full build command,
+ * converted to compiler front end options, without the options producing
+ * output or dependency files.  An input whose command is not understood is
+ * reported and left out.
+ *
+ * @param resourceDir
+ *          resource directory of this program, whose builtin headers
+ *          replace those of the compiler named by the commands
+ * @return false if the compilation database could not be read
+ */
+bool loadCompileCommands(
+    const std::string& buildDirectory,
+    const std::string& resourceDir,
+    PlannedInputs& inputs,
+    std::string& errorMessage);
+
+/**
+ * Removes inputs which would be analyzed with the same results as an earlier
+ * input, because they name the same file with the same build options,
+ * ignoring warning and debug information options.
+ *
+ * @return number of inputs removed
+ */
+std::size_t removeEquivalentInputs(PlannedInputs& inputs);
+
+/**
+ * Estimates the cost of each input from the seconds recorded in the history,
+ * or else from the input file size, scaled to seconds by the inputs having
+ * both.
+ */
+void estimateCosts(PlannedInputs& inputs, const CostHistory& history);
+
+/**
+ * Orders indexes of inputs by descending cost, so the largest inputs start
+ * first and parallel workers finish at about the same time.
+ */
+std::vector<std::size_t> scheduleLargestFirst(const PlannedInputs& inputs);
+
+#endif
@@ -0,0 +1,236 @@
+#include "ReplacementSet.h"
+#include <algorithm>
+
+namespace {
+
+// Search all subsets of candidates if there are at most this many.
+const std::size_t MAX_EXACT_CANDIDATES = 16;
+
+/**
+ * Tracks the headers brought in and items provided by a set of candidates.
+ */
+class Selection
+{
+  const std::vector<ReplacementCandidate>& candidates_;
+  const std::vector<std::size_t>& headerCosts_;
+
+  // number of chosen candidates bringing in each header
+  std::vector<unsigned> headerCounts_;
+
+  // number of chosen candidates providing each item
+  std::vector<unsigned> itemCounts_;
+
+public:
+  /** total cost of headers brought in */
+  std::size_t cost_;
+
+  /** number of items provided */
+  std::size_t itemsProvided_;
+
+  Selection (
+      const std::vector<ReplacementCandidate>& candidates,
+      const std::vector<std::size_t>& headerCosts,
+      std::size_t itemCount):
+    candidates_(candidates),
+    headerCosts_(headerCosts),
+    headerCounts_(headerCosts.size()),
+    itemCounts_(itemCount),
+    cost_(0),
+    itemsProvided_(0)
+  { }
+
+  void add (std::size_t candidate)
+  {
+    const ReplacementCandidate& c = candidates_[candidate];
+    for (std::size_t i = 0; i < c.headers_.size(); ++i) {
+      if (headerCounts_[c.headers_[i]]++ == 0) {
+        cost_ += headerCosts_[c.headers_[i]];
+      }
+    }
+    for (std::size_t i = 0; i < c.items_.size(); ++i) {
+      if (itemCounts_[c.items_[i]]++ == 0) {
+        ++itemsProvided_;
+      }
+    }
+  }
+
+  void remove (std::size_t candidate)
+  {
+    const ReplacementCandidate& c = candidates_[candidate];
+    for (std::size_t i = 0; i < c.headers_.size(); ++i) {
+      if (--headerCounts_[c.headers_[i]] == 0) {
+        cost_ -= headerCosts_[c.headers_[i]];
+      }
+    }
+    for (std::size_t i = 0; i < c.items_.size(); ++i) {
+      if (--itemCounts_[c.items_[i]] == 0) {
+        --itemsProvided_;
+      }
+    }
+  }
+
+  /**
+   * Computes the cost of headers the candidate would add.
+   */
+  std::size_t addedCost (std::size_t candidate) const
+  {
+    const ReplacementCandidate& c = candidates_[candidate];
+    std::size_t cost = 0;
+    for (std::size_t i = 0; i < c.headers_.size(); ++i) {
+      if (headerCounts_[c.headers_[i]] == 0) {
+        cost += headerCosts_[c.headers_[i]];
+      }
+    }
+    return cost;
+  }
+
+  /**
+   * Counts the items the candidate would add.
+   */
+  std::size_t addedItems (std::size_t candidate) const
+  {
+    const ReplacementCandidate& c = candidates_[candidate];
+    std::size_t count = 0;
+    for (std::size_t i = 0; i < c.items_.size(); ++i) {
+      if (itemCounts_[c.items_[i]] == 0) {
+        ++count;
+      }
+    }
+    return count;
+  }
+};
+
+/**
+ * Branch and bound search for the cheapest set of candidates providing all
+ * items.
+ */
+class ExactSearch
+{
+  const std::vector<std::size_t>& useful_;
+  std::size_t itemTotal_;
+  Selection selection_;
+  std::vector<std::size_t> chosen_;
+
+public:
+  std::vector<std::size_t> best_;
+  std::size_t bestCost_;
+
+  ExactSearch (
+      const std::vector<ReplacementCandidate>& candidates,
+      const std::vector<std::size_t>& headerCosts,
+      std::size_t itemCount,
+      const std::vector<std::size_t>& useful,
+      std::size_t itemTotal,
+      const std::vector<std::size_t>& initial,
+      std::size_t initialCost):
+    useful_(useful),
+    itemTotal_(itemTotal),
+    selection_(candidates, headerCosts, itemCount),
+    best_(initial),
+    bestCost_(initialCost)
+  { }
+
+  void search (std::size_t next)
+  {
+    if (selection_.cost_ >= bestCost_) {
+      return;
+    }
+
+    if (selection_.itemsProvided_ == itemTotal_) {
+      best_ = chosen_;
+      bestCost_ = selection_.cost_;
+      return;
+    }
+
+    if (next == useful_.size()) {
+      return;
+    }
+
+    std::size_t candidate = useful_[next];
+    if (selection_.addedItems(candidate) > 0) {
+      selection_.add(candidate);
+      chosen_.push_back(candidate);
+      search(next + 1);
+      chosen_.pop_back();
+      selection_.remove(candidate);
+    }
+
+    search(next + 1);
+  }
+};
+
+}//namespace
+
+std::vector<std::size_t>
+chooseReplacement (
+    const std::vector<ReplacementCandidate>& candidates,
+    const std::vector<std::size_t>& headerCosts,
+    std::size_t itemCount,
+    std::size_t* pCost)
+{
+  // Ignore candidates which provide nothing.
+  std::vector<std::size_t> useful;
+  std::vector<bool> provided(itemCount);
+  std::size_t itemTotal = 0;
+  for (std::size_t i = 0; i < candidates.size(); ++i) {
+    const std::vector<std::size_t>& items = candidates[i].items_;
+    if (items.empty()) {
+      continue;
+    }
+
+    useful.push_back(i);
+    for (std::size_t j = 0; j < items.size(); ++j) {
+      if (!provided[items[j]]) {
+        provided[items[j]] = true;
+        ++itemTotal;
+      }
+    }
+  }
+
+  // Greedily choose the candidate adding the least cost per added item.
+  // Ties go to the candidate listed first.
+  Selection selection(candidates, headerCosts, itemCount);
+  std::vector<std::size_t> chosen;
+  while (selection.itemsProvided_ < itemTotal) {
+    std::size_t best = candidates.size();
+    std::size_t bestCost = 0;
+    std::size_t bestItems = 0;
+    for (std::size_t i = 0; i < useful.size(); ++i) {
+      std::size_t items = selection.addedItems(useful[i]);
+      if (items == 0) {
+        continue;
+      }
+
+      std::size_t cost = selection.addedCost(useful[i]);
+      if (best == candidates.size() || cost * bestItems < bestCost * items) {
+        best = useful[i];
+        bestCost = cost;
+        bestItems = items;
+      }
+    }
+
+    selection.add(best);
+    chosen.push_back(best);
+  }
+
+  std::size_t cost = selection.cost_;
+  if (useful.size() <= MAX_EXACT_CANDIDATES) {
+    ExactSearch search(
+        candidates,
+        headerCosts,
+        itemCount,
+        useful,
+        itemTotal,
+        chosen,
+        cost);
+    search.search(0);
+    chosen = search.best_;
+    cost = search.bestCost_;
+  }
+
+  std::sort(chosen.begin(), chosen.end());
+  if (pCost != 0) {
+    *pCost = cost;
+  }
+  return chosen;
+}
@@ -0,0 +1,40 @@
+#ifndef REPLACEMENTSET_H
+#define REPLACEMENTSET_H
+
+#include <cstddef>
+#include <vector>
+
+/**
+ * Header which may be included in place of a replaceable header.  Headers
+ * and the items they provide are identified by indexes.
+ */
+struct ReplacementCandidate
+{
+  /** headers the candidate brings in, including itself */
+  std::vector<std::size_t> headers_;
+
+  /** needed items, such as used symbols, the candidate provides */
+  std::vector<std::size_t> items_;
+};
+
+/**
+ * Chooses candidates which together provide every item provided by any
+ * candidate, at the lowest total cost of the headers they bring in.  A header
+ * brought in by more than one chosen candidate is counted once.  The choice
+ * is exact for few candidates and greedy otherwise.
+ *
+ * @param headerCosts
+ *          cost of each header
+ * @param itemCount
+ *          number of items
+ * @param pCost
+ *          if not null, receives the total cost of the chosen candidates
+ * @return indexes of the chosen candidates in ascending order
+ */
+std::vector<std::size_t> chooseReplacement(
+    const std::vector<ReplacementCandidate>& candidates,
+    const std::vector<std::size_t>& headerCosts,
+    std::size_t itemCount,
+    std::size_t* pCost = 0);
+
+#endif
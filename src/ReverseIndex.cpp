@@ -0,0 +1,134 @@
+#include "ReverseIndex.h"
+#include "PathUtil.h"
+#include "llvm/Support/FileSystem.h"
+#include <fstream>
+
+using namespace llvm;
+
+namespace {
+
+// First line of an index file.  The index is text with one line per file,
+// each followed by lines starting with a tab naming the main source files
+// including it.
+const char* const INDEX_SIGNATURE = "find-unnecessary-includes reverse index 1";
+
+}//namespace
+
+void
+ReverseIndex::add (const std::string& mainSource, const std::string& file)
+{
+  sourceToFiles_[mainSource].insert(file);
+  fileToSources_[file].insert(mainSource);
+}
+
+bool
+ReverseIndex::load (const std::string& path, std::string& errorMessage)
+{
+  bool exists;
+  if (sys::fs::exists(path, exists) || !exists) {
+    return true;
+  }
+
+  std::ifstream in(path.c_str());
+  std::string line;
+  if (!std::getline(in, line) || line != INDEX_SIGNATURE) {
+    errorMessage = path + " is not a reverse index file";
+    return false;
+  }
+
+  std::string file;
+  while (std::getline(in, line)) {
+    if (line.empty()) {
+      continue;
+    }
+
+    if (line[0] == '\t') {
+      add(line.substr(1), file);
+    } else {
+      file = line;
+    }
+  }
+
+  if (in.bad()) {
+    errorMessage = "cannot read " + path;
+    return false;
+  }
+  return true;
+}
+
+bool
+ReverseIndex::save (const std::string& path, std::string& errorMessage) const
+{
+  std::ofstream out(path.c_str());
+  out << INDEX_SIGNATURE << '\n';
+  for (FileToSourcesMap::const_iterator pPair = fileToSources_.begin();
+      pPair != fileToSources_.end();
+      ++pPair)
+  {
+    out << pPair->first << '\n';
+    for (Names::const_iterator pMainSource = pPair->second.begin();
+        pMainSource != pPair->second.end();
+        ++pMainSource)
+    {
+      out << '\t' << *pMainSource << '\n';
+    }
+  }
+
+  out.close();
+  if (!out) {
+    errorMessage = "cannot write " + path;
+    return false;
+  }
+  return true;
+}
+
+void
+ReverseIndex::update (SourceFile::Ptr pMainSource)
+{
+  std::string mainSource(normalizePath(pMainSource->name()));
+
+  // Forget the previous closure.
+  SourceToFilesMap::iterator pPair = sourceToFiles_.find(mainSource);
+  if (pPair != sourceToFiles_.end()) {
+    for (Names::iterator pFile = pPair->second.begin();
+        pFile != pPair->second.end();
+        ++pFile)
+    {
+      FileToSourcesMap::iterator pSources = fileToSources_.find(*pFile);
+      pSources->second.erase(mainSource);
+      if (pSources->second.empty()) {
+        fileToSources_.erase(pSources);
+      }
+    }
+    sourceToFiles_.erase(pPair);
+  }
+
+  extend(pMainSource);
+}
+
+void
+ReverseIndex::extend (SourceFile::Ptr pMainSource)
+{
+  std::string mainSource(normalizePath(pMainSource->name()));
+
+  // An imported module brings in the files of its headers.
+  UsedHeaders files;
+  pMainSource->collectNestedFiles(files);
+
+  add(mainSource, mainSource);
+  for (UsedHeaders::iterator pName = files.begin();
+      pName != files.end();
+      ++pName)
+  {
+    add(mainSource, normalizePath(*pName));
+  }
+}
+
+void
+ReverseIndex::findAffected (const std::string& file, Names& mainSources) const
+{
+  FileToSourcesMap::const_iterator pPair = fileToSources_.find(file);
+  if (pPair != fileToSources_.end()) {
+    mainSources.insert(pPair->second.begin(), pPair->second.end());
+  }
+}
@@ -0,0 +1,65 @@
+#ifndef REVERSEINDEX_H
+#define REVERSEINDEX_H
+
+#include "UnnecessaryIncludeFinder.h"
+#include <map>
+#include <set>
+#include <string>
+
+/**
+ * Persistent map from each file to the main source files whose include
+ * closure contains it.  A main source file is in its own closure.  File names
+ * are normalized with normalizePath.
+ */
+class ReverseIndex
+{
+public:
+  typedef std::set<std::string> Names;
+
+private:
+  // map main source file to files it includes transitively
+  typedef std::map<std::string, Names> SourceToFilesMap;
+  SourceToFilesMap sourceToFiles_;
+
+  // map file to main source files including it transitively
+  typedef std::map<std::string, Names> FileToSourcesMap;
+  FileToSourcesMap fileToSources_;
+
+  void add(const std::string& mainSource, const std::string& file);
+
+public:
+  /**
+   * Reads the index from a file.  A missing file yields an empty index.
+   *
+   * @return false if the file exists but could not be read
+   */
+  bool load(const std::string& path, std::string& errorMessage);
+
+  /**
+   * @return false if the file could not be written
+   */
+  bool save(const std::string& path, std::string& errorMessage) const;
+
+  /**
+   * Replaces the recorded include closure of a main source file.
+   */
+  void update(SourceFile::Ptr pMainSource);
+
+  /**
+   * Adds to the recorded include closure of a main source file.
+   */
+  void extend(SourceFile::Ptr pMainSource);
+
+  /**
+   * Checks if the index has recorded the main source file.
+   */
+  bool contains (const std::string& mainSource) const
+  { return sourceToFiles_.count(mainSource) != 0; }
+
+  /**
+   * Adds the main source files whose include closure contains the file.
+   */
+  void findAffected(const std::string& file, Names& mainSources) const;
+};
+
+#endif
@@ -0,0 +1,246 @@
+#include "SharedFileCache.h"
+#include "clang/Basic/FileManager.h"
+#include "clang/Basic/FileSystemStatCache.h"
+#include "llvm/ADT/OwningPtr.h"
+#include "llvm/Support/MutexGuard.h"
+
+using namespace clang;
+using namespace llvm;
+
+/**
+ * Adapts the shared stat results to the interface of the file manager, which
+ * takes ownership of it.
+ */
+class SharedStatCache: public FileSystemStatCache
+{
+  SharedFileCache& cache_;
+
+public:
+  SharedStatCache (SharedFileCache& cache):
+    cache_(cache)
+  { }
+
+  virtual LookupResult getStat(
+      const char* path, struct stat& status, int* pFileDescriptor);
+};
+
+FileSystemStatCache::LookupResult
+SharedStatCache::getStat (
+    const char* path, struct stat& status, int* pFileDescriptor)
+{
+  {
+    MutexGuard guard(cache_.mutex_);
+    SharedFileCache::PathToStatMap::iterator pPair =
+        cache_.pathToStatMap_.find(path);
+    if (pPair != cache_.pathToStatMap_.end()) {
+      // The file manager opens the file itself when it gets no descriptor.
+      const SharedFileCache::StatResult& result = pPair->getValue();
+      if (!result.exists_) {
+        return CacheMissing;
+      }
+      status = result.status_;
+      return CacheExists;
+    }
+  }
+
+  // Don't hold the lock while accessing the file system.
+  LookupResult lookupResult = statChained(path, status, pFileDescriptor);
+
+  SharedFileCache::StatResult result;
+  result.exists_ = (lookupResult == CacheExists);
+  result.status_ = status;
+
+  MutexGuard guard(cache_.mutex_);
+  cache_.pathToStatMap_[path] = result;
+  return lookupResult;
+}
+
+/**
+ * Makes the source manager read an included file from the shared contents
+ * instead of reading its own copy.
+ */
+class SharedContentsCallbacks: public PPCallbacks
+{
+  SharedFileCache& cache_;
+  SourceManager& sourceManager_;
+
+public:
+  SharedContentsCallbacks (
+      SharedFileCache& cache, SourceManager& sourceManager):
+    cache_(cache),
+    sourceManager_(sourceManager)
+  { }
+
+  virtual void InclusionDirective(
+      SourceLocation hashLoc,
+      const Token& includeToken,
+      StringRef fileName,
+      bool isAngled,
+      CharSourceRange filenameRange,
+      const FileEntry* pFile,
+      StringRef searchPath,
+      StringRef relativePath,
+      const Module* pImported);
+};
+
+void
+SharedContentsCallbacks::InclusionDirective (
+    SourceLocation hashLoc,
+    const Token& includeToken,
+    StringRef fileName,
+    bool isAngled,
+    CharSourceRange filenameRange,
+    const FileEntry* pFile,
+    StringRef searchPath,
+    StringRef relativePath,
+    const Module* pImported)
+{
+  // Contents already read must not be replaced, because tokens point into
+  // them.
+  if (pFile == 0 || pImported != 0 || sourceManager_.hasFileInfo(pFile)) {
+    return;
+  }
+
+  StringRef path(pFile->getName());
+  const MemoryBuffer* pBuffer;
+  {
+    MutexGuard guard(cache_.mutex_);
+    pBuffer = cache_.acquire(path);
+  }
+
+  if (pBuffer == 0) {
+    // Don't hold the lock while reading the file.  Another compiler instance
+    // may read it at the same time, and the first to insert it wins.
+    OwningPtr<MemoryBuffer> pRead;
+    if (MemoryBuffer::getFile(path, pRead)) {
+      return;
+    }
+
+    MutexGuard guard(cache_.mutex_);
+    pBuffer = cache_.insert(path, pRead.take());
+  }
+
+  // The file changed after its status was read.  Let the source manager
+  // report it.
+  if (pBuffer->getBufferSize() != std::size_t(pFile->getSize())) {
+    MutexGuard guard(cache_.mutex_);
+    cache_.release(path, pBuffer);
+    return;
+  }
+
+  // The cache owns the buffer, so the source manager must not free it.
+  sourceManager_.overrideFileContents(pFile, pBuffer, true);
+}
+
+SharedFileCache::~SharedFileCache ()
+{
+  for (PathToFileMap::iterator pPair = pathToFileMap_.begin();
+      pPair != pathToFileMap_.end();
+      ++pPair)
+  {
+    delete pPair->getValue().pBuffer_;
+  }
+}
+
+/**
+ * Gets the kept contents of a file and counts a user of them.
+ *
+ * @return null if the contents are not kept
+ */
+const MemoryBuffer*
+SharedFileCache::acquire (StringRef path)
+{
+  PathToFileMap::iterator pPair = pathToFileMap_.find(path);
+  if (pPair == pathToFileMap_.end()) {
+    return 0;
+  }
+
+  CachedFile& file = pPair->getValue();
+  if (file.users_++ == 0) {
+    idleFiles_.erase(file.pIdle_);
+  }
+  return file.pBuffer_;
+}
+
+/**
+ * Keeps the contents of a file read by a user, and counts the user.
+ *
+ * @return the contents kept, which are different from the contents given if
+ *         another user inserted the file first
+ */
+const MemoryBuffer*
+SharedFileCache::insert (StringRef path, const MemoryBuffer* pBuffer)
+{
+  const MemoryBuffer* pKept = acquire(path);
+  if (pKept != 0) {
+    delete pBuffer;
+    return pKept;
+  }
+
+  CachedFile& file = pathToFileMap_[path];
+  file.pBuffer_ = pBuffer;
+  file.users_ = 1;
+  bytes_ += pBuffer->getBufferSize();
+  return pBuffer;
+}
+
+void
+SharedFileCache::release (StringRef path, const MemoryBuffer* pBuffer)
+{
+  PathToFileMap::iterator pPair = pathToFileMap_.find(path);
+  if (pPair == pathToFileMap_.end() || pPair->getValue().pBuffer_ != pBuffer)
+  {
+    return;
+  }
+
+  CachedFile& file = pPair->getValue();
+  if (--file.users_ == 0) {
+    file.pIdle_ = idleFiles_.insert(idleFiles_.end(), path.str());
+  }
+  evict();
+}
+
+void
+SharedFileCache::evict ()
+{
+  while (bytes_ > maxBytes_ && !idleFiles_.empty()) {
+    PathToFileMap::iterator pPair = pathToFileMap_.find(idleFiles_.front());
+    idleFiles_.pop_front();
+
+    bytes_ -= pPair->getValue().pBuffer_->getBufferSize();
+    delete pPair->getValue().pBuffer_;
+    pathToFileMap_.erase(pPair);
+  }
+}
+
+void
+SharedFileCache::attach (CompilerInstance& compiler)
+{
+  if (!compiler.hasFileManager()) {
+    compiler.createFileManager();
+  }
+  compiler.getFileManager().addStatCache(new SharedStatCache(*this));
+}
+
+PPCallbacks*
+SharedFileCache::createPreprocessorCallbacks (SourceManager& sourceManager)
+{
+  return new SharedContentsCallbacks(*this, sourceManager);
+}
+
+void
+SharedFileCache::releaseFiles (SourceManager& sourceManager)
+{
+  MutexGuard guard(mutex_);
+  for (SourceManager::fileinfo_iterator pPair = sourceManager.fileinfo_begin();
+      pPair != sourceManager.fileinfo_end();
+      ++pPair)
+  {
+    const FileEntry* pFile = pPair->first;
+    const MemoryBuffer* pBuffer = pPair->second->getRawBuffer();
+    if (pFile != 0 && pBuffer != 0) {
+      // Contents the source manager read itself are not in the cache.
+      release(pFile->getName(), pBuffer);
+    }
+  }
+}
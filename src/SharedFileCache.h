@@ -0,0 +1,105 @@
+#ifndef SHAREDFILECACHE_H
+#define SHAREDFILECACHE_H
+
+#include "clang/Basic/SourceManager.h"
+#include "clang/Frontend/CompilerInstance.h"
+#include "clang/Lex/PPCallbacks.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Mutex.h"
+#include <cstddef>
+#include <list>
+#include <string>
+#include <sys/stat.h>
+
+/**
+ * File system information shared by compiler instances, which may run on
+ * different threads.  Results of stat calls are remembered, so header search
+ * probes each path once.  The first compiler instance to include a file reads
+ * its contents into the cache, and every compiler instance including the file
+ * afterwards, including ones running at the same time, uses the same buffer,
+ * so the work per compiler instance depends only on the files it includes.
+ *
+ * Contents no running compiler instance uses are evicted, least recently
+ * used first, when the kept contents exceed a size limit.
+ */
+class SharedFileCache
+{
+  friend class SharedStatCache;
+  friend class SharedContentsCallbacks;
+
+  struct StatResult
+  {
+    bool exists_;
+    struct stat status_;
+  };
+
+  typedef llvm::StringMap<StatResult> PathToStatMap;
+  PathToStatMap pathToStatMap_;
+
+  // paths of kept files no compiler instance uses, least recently used first
+  typedef std::list<std::string> IdleFiles;
+  IdleFiles idleFiles_;
+
+  struct CachedFile
+  {
+    const llvm::MemoryBuffer* pBuffer_;
+
+    // number of compiler instances using the contents
+    unsigned users_;
+
+    // position in idleFiles_ if there are no users
+    IdleFiles::iterator pIdle_;
+  };
+
+  typedef llvm::StringMap<CachedFile> PathToFileMap;
+  PathToFileMap pathToFileMap_;
+
+  // total size of the kept contents
+  std::size_t bytes_;
+
+  std::size_t maxBytes_;
+
+  llvm::sys::Mutex mutex_;
+
+  const llvm::MemoryBuffer* acquire(llvm::StringRef path);
+
+  const llvm::MemoryBuffer* insert(
+      llvm::StringRef path, const llvm::MemoryBuffer* pBuffer);
+
+  void release(llvm::StringRef path, const llvm::MemoryBuffer* pBuffer);
+
+  void evict();
+
+public:
+  /** default limit on the size of contents kept while not in use */
+  static const std::size_t DEFAULT_MAX_BYTES = 256 * 1024 * 1024;
+
+  explicit SharedFileCache (std::size_t maxBytes = DEFAULT_MAX_BYTES):
+    bytes_(0),
+    maxBytes_(maxBytes)
+  { }
+
+  ~SharedFileCache();
+
+  /**
+   * Makes the compiler instance use the cache.  Call before executing an
+   * action.
+   */
+  void attach(clang::CompilerInstance& compiler);
+
+  /**
+   * Creates callbacks which serve the shared contents of each file included
+   * through the preprocessor of an attached compiler instance.
+   */
+  clang::PPCallbacks* createPreprocessorCallbacks(
+      clang::SourceManager& sourceManager);
+
+  /**
+   * Releases the contents the source manager got from the cache.  Call when
+   * the compiler instance has finished with them.
+   */
+  void releaseFiles(clang::SourceManager& sourceManager);
+};
+
+#endif
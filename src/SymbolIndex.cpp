@@ -0,0 +1,163 @@
+#include "SymbolIndex.h"
+#include "llvm/Support/FileSystem.h"
+#include <fstream>
+#include <sstream>
+
+using namespace llvm;
+
+namespace {
+
+// First line of an index file.  The index is text with one line per header
+// giving its name and contents hash separated by a tab, each followed by
+// lines starting with a tab naming the symbols it declares, and lines
+// starting with two tabs giving the names of its namespace scope symbols and
+// macros.
+const char* const INDEX_SIGNATURE = "find-unnecessary-includes symbol index 2";
+
+// First line of an index file written by an earlier version, which is
+// rebuilt.
+const char* const OLD_INDEX_SIGNATURE =
+    "find-unnecessary-includes symbol index 1";
+
+}//namespace
+
+uint64_t
+SymbolIndex::hashContents (StringRef contents)
+{
+  // 64-bit FNV-1a
+  uint64_t hash = 14695981039346656037ULL;
+  for (StringRef::iterator pChar = contents.begin();
+      pChar != contents.end();
+      ++pChar)
+  {
+    hash ^= static_cast<unsigned char>(*pChar);
+    hash *= 1099511628211ULL;
+  }
+  return hash;
+}
+
+bool
+SymbolIndex::load (const std::string& path, std::string& errorMessage)
+{
+  bool exists;
+  if (sys::fs::exists(path, exists) || !exists) {
+    return true;
+  }
+
+  std::ifstream in(path.c_str());
+  std::string line;
+  if (std::getline(in, line) && line == OLD_INDEX_SIGNATURE) {
+    return true;
+  }
+  if (!in || line != INDEX_SIGNATURE) {
+    errorMessage = path + " is not a symbol index file";
+    return false;
+  }
+
+  Entry* pEntry = 0;
+  while (std::getline(in, line)) {
+    if (line.empty()) {
+      continue;
+    }
+
+    if (line.compare(0, 2, "\t\t") == 0) {
+      if (pEntry != 0) {
+        pEntry->screenNames_.insert(line.substr(2));
+      }
+      continue;
+    }
+    if (line[0] == '\t') {
+      if (pEntry != 0) {
+        pEntry->symbols_.insert(line.substr(1));
+      }
+      continue;
+    }
+
+    std::string::size_type tab = line.rfind('\t');
+    if (tab == std::string::npos) {
+      errorMessage = path + " is corrupt";
+      return false;
+    }
+
+    pEntry = &headerToEntryMap_[line.substr(0, tab)];
+    std::istringstream hashIn(line.substr(tab + 1));
+    hashIn >> std::hex >> pEntry->hash_;
+    pEntry->symbols_.clear();
+    pEntry->screenNames_.clear();
+  }
+
+  if (in.bad()) {
+    errorMessage = "cannot read " + path;
+    return false;
+  }
+  return true;
+}
+
+bool
+SymbolIndex::save (const std::string& path, std::string& errorMessage) const
+{
+  std::ofstream out(path.c_str());
+  out << INDEX_SIGNATURE << '\n';
+  for (HeaderToEntryMap::const_iterator pPair = headerToEntryMap_.begin();
+      pPair != headerToEntryMap_.end();
+      ++pPair)
+  {
+    out << pPair->first << '\t' << std::hex << pPair->second.hash_
+        << std::dec << '\n';
+    const Symbols& symbols = pPair->second.symbols_;
+    for (Symbols::const_iterator pSymbol = symbols.begin();
+        pSymbol != symbols.end();
+        ++pSymbol)
+    {
+      out << '\t' << *pSymbol << '\n';
+    }
+    const Symbols& screenNames = pPair->second.screenNames_;
+    for (Symbols::const_iterator pName = screenNames.begin();
+        pName != screenNames.end();
+        ++pName)
+    {
+      out << "\t\t" << *pName << '\n';
+    }
+  }
+
+  out.close();
+  if (!out) {
+    errorMessage = "cannot write " + path;
+    return false;
+  }
+  return true;
+}
+
+bool
+SymbolIndex::isCurrent (const std::string& header, uint64_t hash) const
+{
+  HeaderToEntryMap::const_iterator pPair = headerToEntryMap_.find(header);
+  return pPair != headerToEntryMap_.end() && pPair->second.hash_ == hash;
+}
+
+void
+SymbolIndex::setSymbols (
+    const std::string& header,
+    uint64_t hash,
+    const Symbols& symbols,
+    const Symbols& screenNames)
+{
+  Entry& entry = headerToEntryMap_[header];
+  entry.hash_ = hash;
+  entry.symbols_ = symbols;
+  entry.screenNames_ = screenNames;
+}
+
+const SymbolIndex::Symbols*
+SymbolIndex::getSymbols (const std::string& header) const
+{
+  HeaderToEntryMap::const_iterator pPair = headerToEntryMap_.find(header);
+  return (pPair != headerToEntryMap_.end()) ? &pPair->second.symbols_ : 0;
+}
+
+const SymbolIndex::Symbols*
+SymbolIndex::getScreenNames (const std::string& header) const
+{
+  HeaderToEntryMap::const_iterator pPair = headerToEntryMap_.find(header);
+  return (pPair != headerToEntryMap_.end()) ? &pPair->second.screenNames_ : 0;
+}
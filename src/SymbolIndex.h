@@ -0,0 +1,92 @@
+#ifndef SYMBOLINDEX_H
+#define SYMBOLINDEX_H
+
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/DataTypes.h"
+#include <map>
+#include <set>
+#include <string>
+
+/**
+ * Persistent map from each header to the symbols it declares.  An entry is
+ * keyed by a hash of the header contents, so it stays valid across
+ * translation units and runs until the header changes.  Header names are
+ * normalized with normalizePath.
+ */
+class SymbolIndex
+{
+public:
+  typedef std::set<std::string> Symbols;
+
+private:
+  struct Entry
+  {
+    uint64_t hash_;
+    Symbols symbols_;
+
+    // unqualified names of the namespace scope symbols and macros
+    Symbols screenNames_;
+
+    Entry ():
+      hash_(0)
+    { }
+  };
+
+  typedef std::map<std::string, Entry> HeaderToEntryMap;
+  HeaderToEntryMap headerToEntryMap_;
+
+public:
+  /**
+   * Computes hash of file contents.
+   */
+  static uint64_t hashContents(llvm::StringRef contents);
+
+  /**
+   * Reads the index from a file.  A missing file yields an empty index.
+   *
+   * @return false if the file exists but could not be read
+   */
+  bool load(const std::string& path, std::string& errorMessage);
+
+  /**
+   * @return false if the file could not be written
+   */
+  bool save(const std::string& path, std::string& errorMessage) const;
+
+  /**
+   * Checks if the index has the symbols of the header with the given
+   * contents hash.
+   */
+  bool isCurrent(const std::string& header, uint64_t hash) const;
+
+  /**
+   * Replaces the symbols recorded for the header.
+   *
+   * @param screenNames
+   *          unqualified names of the symbols declared at namespace scope and
+   *          the macros, which can name them without qualification in any
+   *          file including the header
+   */
+  void setSymbols(
+      const std::string& header,
+      uint64_t hash,
+      const Symbols& symbols,
+      const Symbols& screenNames);
+
+  /**
+   * Gets the symbols declared by the header.
+   *
+   * @return null if the header is not in the index
+   */
+  const Symbols* getSymbols(const std::string& header) const;
+
+  /**
+   * Gets the unqualified names of the namespace scope symbols and macros
+   * declared by the header.
+   *
+   * @return null if the header is not in the index
+   */
+  const Symbols* getScreenNames(const std::string& header) const;
+};
+
+#endif
@@ -0,0 +1,234 @@
+#include "ToolOptions.h"
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+namespace {
+
+/**
+ * Checks if the argument is the named option.  If the option takes a value,
+ * the value may follow an '=' in the same argument or be the next argument.
+ *
+ * @return true if the argument matched
+ */
+bool
+matchOption (
+    const char* name,
+    int argc,
+    char* argv[],
+    int& i,
+    std::string* pValue = 0)
+{
+  std::size_t nameLength = std::strlen(name);
+  const char* arg = argv[i];
+  if (std::strncmp(arg, name, nameLength) != 0) {
+    return false;
+  }
+
+  if (pValue == 0) {
+    return arg[nameLength] == '\0';
+  }
+
+  if (arg[nameLength] == '=') {
+    *pValue = arg + nameLength + 1;
+    return true;
+  }
+
+  if (arg[nameLength] == '\0' && i + 1 < argc) {
+    *pValue = argv[++i];
+    return true;
+  }
+
+  return false;
+}
+
+bool
+parseCostKey (const std::string& value, CostKey& key)
+{
+  if (value == "bytes") {
+    key = COST_BYTES;
+  } else if (value == "tokens") {
+    key = COST_TOKENS;
+  } else if (value == "headers") {
+    key = COST_HEADERS;
+  } else if (value == "time") {
+    key = COST_TIME;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+/**
+ * Parses a non-negative decimal number.
+ *
+ * @return false if the value is not a number
+ */
+bool
+parseUnsigned (const std::string& value, unsigned& number)
+{
+  char* end;
+  unsigned long parsed = std::strtoul(value.c_str(), &end, 10);
+  if (value.empty() || *end != '\0' || value[0] == '-') {
+    return false;
+  }
+  number = static_cast<unsigned>(parsed);
+  return true;
+}
+
+}//namespace
+
+bool
+ToolOptions::parse (
+    int argc, char* argv[], std::vector<const char*>& clangArgs)
+{
+  for (int i = 1; i < argc; ++i) {
+    if (std::strncmp(argv[i], "--", 2) != 0) {
+      clangArgs.push_back(argv[i]);
+      continue;
+    }
+
+    std::string value;
+    if (matchOption("--cost", argc, argv, i)) {
+      cost_ = true;
+    } else if (matchOption("--sort-by", argc, argv, i, &value)) {
+      if (!parseCostKey(value, sortBy_)) {
+        std::cerr << "error: invalid sort key '" << value << "'\n";
+        return false;
+      }
+      cost_ = true;
+    } else if (matchOption("--summary", argc, argv, i)) {
+      summary_ = true;
+      cost_ = true;
+    } else if (matchOption("--export-graph", argc, argv, i, &value)) {
+      exportGraphFile_ = value;
+    } else if (matchOption("--dump-graph", argc, argv, i, &value)) {
+      dumpGraphFile_ = value;
+    } else if (matchOption("--index", argc, argv, i, &value)) {
+      indexFile_ = value;
+    } else if (matchOption("--changed-files", argc, argv, i, &value)) {
+      changedFilesFile_ = value;
+    } else if (matchOption("--config", argc, argv, i, &value)) {
+      configurations_.push_back(value);
+    } else if (matchOption("--headers", argc, argv, i, &value)) {
+      headers_.push_back(value);
+    } else if (matchOption("--jobs", argc, argv, i, &value)) {
+      if (!parseUnsigned(value, jobs_) || jobs_ == 0) {
+        std::cerr << "error: invalid number of jobs '" << value << "'\n";
+        return false;
+      }
+    } else if (matchOption("--symbol-index", argc, argv, i, &value)) {
+      symbolIndexFile_ = value;
+    } else if (matchOption("--batch", argc, argv, i)) {
+      batch_ = true;
+    } else if (matchOption("--timeout", argc, argv, i, &value)) {
+      if (!parseUnsigned(value, timeout_)) {
+        std::cerr << "error: invalid timeout '" << value << "'\n";
+        return false;
+      }
+    } else if (matchOption("--memory-limit", argc, argv, i, &value)) {
+      if (!parseUnsigned(value, memoryLimit_)) {
+        std::cerr << "error: invalid memory limit '" << value << "'\n";
+        return false;
+      }
+    } else if (matchOption("--recycle-after", argc, argv, i, &value)) {
+      if (!parseUnsigned(value, recycleAfter_)) {
+        std::cerr << "error: invalid number of inputs '" << value << "'\n";
+        return false;
+      }
+    } else if (matchOption("--compile-commands", argc, argv, i, &value)) {
+      compileCommandsDir_ = value;
+    } else if (matchOption("--cost-history", argc, argv, i, &value)) {
+      costHistoryFile_ = value;
+    } else if (matchOption("--fast", argc, argv, i)) {
+      fast_ = true;
+    } else if (matchOption("--fast-only", argc, argv, i)) {
+      fast_ = true;
+      fastOnly_ = true;
+    } else if (matchOption("--parallel-traversal", argc, argv, i)) {
+      parallelTraversal_ = true;
+    } else if (matchOption("--unity", argc, argv, i)) {
+      unity_ = true;
+    } else if (matchOption("--header-map-cache", argc, argv, i, &value)) {
+      headerMapCacheDir_ = value;
+    } else {
+      // Let clang handle its own long options.
+      clangArgs.push_back(argv[i]);
+    }
+  }
+
+  if (!changedFilesFile_.empty() && indexFile_.empty()) {
+    std::cerr << "error: --changed-files requires --index\n";
+    return false;
+  }
+
+  // Headers analyzed as main source files are not selected by the index.
+  if (!changedFilesFile_.empty() && !headers_.empty()) {
+    std::cerr << "error: --changed-files cannot be combined with --headers\n";
+    return false;
+  }
+
+  if (fast_ && symbolIndexFile_.empty()) {
+    std::cerr << "error: --fast requires --symbol-index\n";
+    return false;
+  }
+
+  if (fast_ && (batch_ || !configurations_.empty() || !headers_.empty()
+   || !compileCommandsDir_.empty()))
+  {
+    std::cerr << "error: --fast cannot be combined with --batch, --config, "
+        "--headers or --compile-commands\n";
+    return false;
+  }
+
+  // Inputs cleared by the fast screen are not analyzed, so results spanning
+  // inputs would be incomplete.
+  if (fast_ && (summary_ || !exportGraphFile_.empty())) {
+    std::cerr << "error: --fast cannot be combined with --summary or "
+        "--export-graph\n";
+    return false;
+  }
+
+  if (batch_ && (!configurations_.empty() || !headers_.empty())) {
+    std::cerr << "error: --batch cannot be combined with --config or "
+        "--headers\n";
+    return false;
+  }
+
+  // Each child process reports its own inputs, so results spanning inputs
+  // cannot be produced.
+  if (batch_ && (sortBy_ != COST_NONE || summary_ || !indexFile_.empty()
+   || !exportGraphFile_.empty() || !symbolIndexFile_.empty()))
+  {
+    std::cerr << "error: --batch cannot be combined with --sort-by, "
+        "--summary, --index, --export-graph or --symbol-index\n";
+    return false;
+  }
+
+  // Analyses running on several threads would update the symbol index at
+  // once.
+  if (!symbolIndexFile_.empty() && (!configurations_.empty()
+   || !headers_.empty() || !compileCommandsDir_.empty()))
+  {
+    std::cerr << "error: --symbol-index cannot be combined with --config, "
+        "--headers or --compile-commands\n";
+    return false;
+  }
+
+  // Each configuration would count as a separate translation unit.
+  if (!configurations_.empty() && (summary_ || !exportGraphFile_.empty())) {
+    std::cerr << "error: --config cannot be combined with --summary or "
+        "--export-graph\n";
+    return false;
+  }
+
+  if (unity_ && (batch_ || !configurations_.empty() || !headers_.empty()
+   || !compileCommandsDir_.empty()))
+  {
+    std::cerr << "error: --unity cannot be combined with --batch, --config, "
+        "--headers or --compile-commands\n";
+    return false;
+  }
+
+  return true;
+}
@@ -0,0 +1,140 @@
+#ifndef TOOLOPTIONS_H
+#define TOOLOPTIONS_H
+
+#include <string>
+#include <vector>
+
+/**
+ * Measure by which findings can be ranked.
+ */
+enum CostKey
+{
+  COST_NONE,
+  COST_BYTES,
+  COST_TOKENS,
+  COST_HEADERS,
+  COST_TIME
+};
+
+/**
+ * Options specific to this tool.  They are spelled with a leading "--" to
+ * distinguish them from clang options, which are passed through to clang.
+ */
+class ToolOptions
+{
+public:
+  /** true to measure and report the build cost of each #include directive */
+  bool cost_;
+
+  /** measure by which to sort findings, or COST_NONE to keep source order */
+  CostKey sortBy_;
+
+  /** true to report unused headers and header costs across all inputs */
+  bool summary_;
+
+  /** file to write the binary include graph to, or empty for none */
+  std::string exportGraphFile_;
+
+  /** binary include graph file to print as text, or empty for none */
+  std::string dumpGraphFile_;
+
+  /** reverse include index file to read and update, or empty for none */
+  std::string indexFile_;
+
+  /**
+   * file listing changed files, one per line, or empty to analyze all inputs
+   */
+  std::string changedFilesFile_;
+
+  /**
+   * extra clang options of each configuration to analyze, each a
+   * whitespace-separated list, or empty to analyze only the command line
+   * configuration
+   */
+  std::vector<std::string> configurations_;
+
+  /**
+   * headers to analyze as main source files, each a header, a directory to
+   * search or a file listing headers
+   */
+  std::vector<std::string> headers_;
+
+  /** number of threads to run, or 0 for the number of processors */
+  unsigned jobs_;
+
+  /** symbol index file to read and update, or empty for none */
+  std::string symbolIndexFile_;
+
+  /** true to analyze each input in a supervised child process */
+  bool batch_;
+
+  /** seconds a child process may spend on an input, or 0 for no limit */
+  unsigned timeout_;
+
+  /** megabytes of memory a child process may use, or 0 for no limit */
+  unsigned memoryLimit_;
+
+  /** inputs a child process analyzes before it is replaced, or 0 for never */
+  unsigned recycleAfter_;
+
+  /**
+   * build directory containing compile_commands.json listing the inputs, or
+   * empty to take inputs from the command line
+   */
+  std::string compileCommandsDir_;
+
+  /** file recording time spent on each input, or empty for none */
+  std::string costHistoryFile_;
+
+  /**
+   * true to lex the inputs first and fully analyze only those with #include
+   * directives the lexer could not clear
+   */
+  bool fast_;
+
+  /**
+   * true to report the screen results without fully analyzing inputs whose
+   * headers all have entries in the symbol index
+   */
+  bool fastOnly_;
+
+  /**
+   * true to traverse the top-level declarations of each translation unit on
+   * multiple threads
+   */
+  bool parallelTraversal_;
+
+  /** true to analyze all source inputs through one unity translation unit */
+  bool unity_;
+
+  /**
+   * directory keeping the index of the files in each include directory, or
+   * empty to search include directories without an index
+   */
+  std::string headerMapCacheDir_;
+
+  ToolOptions ():
+    cost_(false),
+    sortBy_(COST_NONE),
+    summary_(false),
+    jobs_(0),
+    batch_(false),
+    timeout_(0),
+    memoryLimit_(0),
+    recycleAfter_(50),
+    fast_(false),
+    fastOnly_(false),
+    parallelTraversal_(false),
+    unity_(false)
+  { }
+
+  /**
+   * Extracts options specific to this tool from the command line.  The
+   * remaining arguments are appended to clangArgs.
+   *
+   * @return false if an option is invalid
+   */
+  bool parse(int argc, char* argv[], std::vector<const char*>& clangArgs);
+};
+
+#endif
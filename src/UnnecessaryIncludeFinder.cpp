@@ -1,15 +1,132 @@
 #include "UnnecessaryIncludeFinder.h"
+#include "IncludeGraph.h"
+#include "Parallel.h"
+#include "PathUtil.h"
+#include "ReplacementSet.h"
+#include "ReverseIndex.h"
+#include "SharedFileCache.h"
 #include "clang/AST/ASTContext.h"
 #include "clang/Basic/FileManager.h"
+#include "clang/Basic/Module.h"
 #include "clang/Frontend/CompilerInstance.h"
+#include "clang/Lex/Lexer.h"
 #include "clang/Lex/Preprocessor.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/Support/Timer.h"
 #include "llvm/Support/raw_ostream.h"
+#include <algorithm>
+#include <iomanip>
 #include <iostream>
+#include <map>
+#include <set>
 #include <utility>
 
 using namespace clang;
 using namespace llvm;
 
+namespace {
+
+/**
+ * Gets name under which use of a module is recorded.  It cannot be mistaken
+ * for a file name.
+ */
+std::string
+getModuleKey (const Module* pModule)
+{
+  return "module:" + pModule->getFullModuleName();
+}
+
+/**
+ * Adds the names of the headers of the module and its submodules.
+ */
+void
+collectModuleFiles (const Module* pModule, std::vector<std::string>& files)
+{
+  if (const FileEntry* pUmbrella = pModule->getUmbrellaHeader()) {
+    files.push_back(pUmbrella->getName());
+  }
+  for (SmallVectorImpl<const FileEntry*>::const_iterator ppHeader =
+          pModule->Headers.begin();
+      ppHeader != pModule->Headers.end();
+      ++ppHeader)
+  {
+    files.push_back((*ppHeader)->getName());
+  }
+
+  for (Module::submodule_const_iterator ppSubmodule =
+          pModule->submodule_begin();
+      ppSubmodule != pModule->submodule_end();
+      ++ppSubmodule)
+  {
+    collectModuleFiles(*ppSubmodule, files);
+  }
+}
+
+/**
+ * Gets the name by which a symbol declared at namespace scope can be named
+ * without qualification in a file including its header.
+ *
+ * @return empty if the symbol is not declared at namespace scope or has no
+ *         identifier
+ */
+std::string
+getScreenName (const NamedDecl* pDecl)
+{
+  if (!pDecl->getDeclContext()->getRedeclContext()->isFileContext()
+   || pDecl->getIdentifier() == 0)
+  {
+    return std::string();
+  }
+  return pDecl->getName().str();
+}
+
+}//namespace
+
+bool
+isFileName (const std::string& name)
+{
+  // Exclude built-in sources and modules.
+  return !name.empty() && name.compare(0, 7, "module:") != 0;
+}
+
+IncludeCost&
+IncludeCost::operator+= (const IncludeCost& other)
+{
+  bytes_ += other.bytes_;
+  tokens_ += other.tokens_;
+  uniqueHeaders_ += other.uniqueHeaders_;
+  seconds_ += other.seconds_;
+  return *this;
+}
+
+double
+IncludeCost::get (CostKey key) const
+{
+  switch (key) {
+  case COST_BYTES:
+    return static_cast<double>(bytes_);
+  case COST_TOKENS:
+    return static_cast<double>(tokens_);
+  case COST_HEADERS:
+    return uniqueHeaders_;
+  case COST_TIME:
+    return seconds_;
+  default:
+    return 0.0;
+  }
+}
+
+void
+IncludeCost::print (std::ostream& out) const
+{
+  std::ios::fmtflags flags(out.flags());
+  out << bytes_ << " bytes, "
+      << tokens_ << " tokens, "
+      << uniqueHeaders_ << " headers, "
+      << std::fixed << std::setprecision(2) << seconds_ * 1000.0 << " ms";
+  out.flags(flags);
+}
+
 void
 IncludeDirective::printFileName (std::ostream& out)
 {
@@ -44,6 +161,97 @@ SourceFile::traverse (IncludeDirectiveVisitor& visitor)
 
 typedef UsedHeaders VisitedHeaders;
 
+namespace {
+
+void
+collectHeaders (SourceFile::Ptr pSource, VisitedHeaders& visitedHeaders)
+{
+  for (SourceFile::IncludeDirectives::iterator ppInclude =
+          pSource->includeDirectives_.begin();
+      ppInclude != pSource->includeDirectives_.end();
+      ++ppInclude)
+  {
+    SourceFile::Ptr pHeader((*ppInclude)->pHeader_);
+    if (visitedHeaders.insert(pHeader->name()).second) {
+      collectHeaders(pHeader, visitedHeaders);
+    }
+  }
+}
+
+void
+collectFiles (
+    SourceFile::Ptr pSource,
+    VisitedHeaders& visitedHeaders,
+    UsedHeaders& files)
+{
+  for (SourceFile::IncludeDirectives::iterator ppInclude =
+          pSource->includeDirectives_.begin();
+      ppInclude != pSource->includeDirectives_.end();
+      ++ppInclude)
+  {
+    SourceFile::Ptr pHeader((*ppInclude)->pHeader_);
+    if (!visitedHeaders.insert(pHeader->name()).second) {
+      continue;
+    }
+
+    if (isFileName(pHeader->name())) {
+      files.insert(pHeader->name());
+    }
+    files.insert(pHeader->moduleFiles_.begin(), pHeader->moduleFiles_.end());
+    collectFiles(pHeader, visitedHeaders, files);
+  }
+}
+
+}//namespace
+
+void
+SourceFile::collectNestedHeaders (UsedHeaders& headers)
+{
+  collectHeaders(this, headers);
+}
+
+void
+SourceFile::collectNestedFiles (UsedHeaders& files)
+{
+  VisitedHeaders visitedHeaders;
+  collectFiles(this, visitedHeaders, files);
+}
+
+void
+SourceFile::countUniqueHeaders ()
+{
+  // Count how many #include directives bring in each header.
+  typedef llvm::StringMap<unsigned> HeaderToCountMap;
+  HeaderToCountMap headerToCountMap;
+
+  std::vector<VisitedHeaders> closures(includeDirectives_.size());
+  for (std::size_t i = 0; i < includeDirectives_.size(); ++i) {
+    SourceFile::Ptr pHeader(includeDirectives_[i]->pHeader_);
+    closures[i].insert(pHeader->name());
+    pHeader->collectNestedHeaders(closures[i]);
+
+    for (VisitedHeaders::iterator pName = closures[i].begin();
+        pName != closures[i].end();
+        ++pName)
+    {
+      ++headerToCountMap[*pName];
+    }
+  }
+
+  for (std::size_t i = 0; i < includeDirectives_.size(); ++i) {
+    unsigned uniqueHeaders = 0;
+    for (VisitedHeaders::iterator pName = closures[i].begin();
+        pName != closures[i].end();
+        ++pName)
+    {
+      if (headerToCountMap.lookup(*pName) == 1) {
+        ++uniqueHeaders;
+      }
+    }
+    includeDirectives_[i]->cost_.uniqueHeaders_ = uniqueHeaders;
+  }
+}
+
 /**
  * Checks if any of the headers included by this source file are used.
  */
@@ -89,12 +297,15 @@ SourceFile::haveNestedUsedHeader (const UsedHeaders& usedHeaders)
  */
 class UsedHeaderReporter: public IncludeDirectiveVisitor
 {
+  std::ostream& out_;
   const UsedHeaders& usedHeaders_;
   VisitedHeaders visitedHeaders_;
 
 public:
   UsedHeaderReporter (
+      std::ostream& out,
       const UsedHeaders& usedHeaders):
+    out_(out),
     usedHeaders_(usedHeaders)
   { }
 
@@ -107,22 +318,57 @@ public:
     visitedHeaders_.insert(fileName);
 
     if (usedHeaders_.count(fileName)) {
-      std::cout << std::endl << "  ";
-      pIncludeDirective->printFileName(std::cout);
+      out_ << std::endl << "  ";
+      pIncludeDirective->printFileName(out_);
     }
     return true;
   }
 };
 
 void
-SourceFile::reportNestedUsedHeaders (const UsedHeaders& usedHeaders)
+SourceFile::reportNestedUsedHeaders (
+    std::ostream& out, const UsedHeaders& usedHeaders)
 {
-  UsedHeaderReporter reporter(usedHeaders);
+  UsedHeaderReporter reporter(out, usedHeaders);
   traverse(reporter);
 }
 
+void
+UnnecessaryInclude::report (
+    std::ostream& out, bool showCost)
+{
+  pIncludeDirective_->printWarningPrefix(out);
+  out << (replaceable_ ? "is replaceable" : "is unnecessary");
+  if (showCost) {
+    out << " (cost: ";
+    pIncludeDirective_->cost_.print(out);
+    out << ')';
+  }
+
+  if (!suggestedIncludes_.empty()) {
+    out << ". Include these headers instead, saving "
+        << (replacedBytes_ - suggestedBytes_) << " of " << replacedBytes_
+        << " bytes:";
+    for (std::vector<IncludeDirective::Ptr>::iterator ppInclude =
+            suggestedIncludes_.begin();
+        ppInclude != suggestedIncludes_.end();
+        ++ppInclude)
+    {
+      out << std::endl << "  ";
+      (*ppInclude)->printFileName(out);
+    }
+  } else if (replaceable_) {
+    out << ". It includes these used headers:";
+    pIncludeDirective_->pHeader_->reportNestedUsedHeaders(
+        out, *pAllUsedHeaders_);
+  }
+
+  out << std::endl;
+}
+
 bool
-SourceFile::reportUnnecessaryIncludes (const UsedHeaders& allUsedHeaders)
+SourceFile::findUnnecessaryIncludes (
+    const UsedHeaders& allUsedHeaders, UnnecessaryIncludes& found)
 {
   bool foundUnnecessary = false;
 
@@ -144,15 +390,8 @@ SourceFile::reportUnnecessaryIncludes (const UsedHeaders& allUsedHeaders)
       }
 
       foundUnnecessary = true;
-      pIncludeDirective->printWarningPrefix(std::cout);
-      if (haveNestedUsedHeader) {
-        std::cout << "is replaceable. It includes these used headers:";
-        pHeader->reportNestedUsedHeaders(allUsedHeaders);
-      } else {
-        std::cout << "is unnecessary";
-      }
-
-      std::cout << std::endl;
+      found.push_back(UnnecessaryInclude(
+          pIncludeDirective, haveNestedUsedHeader, allUsedHeaders));
     }
   }
 
@@ -215,6 +454,11 @@ public:
   {
     delegate_.MacroExpands(nameToken, pMacro, range);
   }
+
+  virtual void MacroDefined (const Token& nameToken, const MacroInfo* pMacro)
+  {
+    delegate_.MacroDefined(nameToken, pMacro);
+  }
 };
 
 }//namespace
@@ -225,13 +469,42 @@ UnnecessaryIncludeFinder::createPreprocessorCallbacks ()
   return new PreprocessorCallbacks(*this);
 }
 
+UnnecessaryIncludeFinder::~UnnecessaryIncludeFinder ()
+{
+  for (FileToPendingSymbolsMap::iterator pPair =
+          fileToPendingSymbolsMap_.begin();
+      pPair != fileToPendingSymbolsMap_.end();
+      ++pPair)
+  {
+    delete pPair->second;
+  }
+}
+
 void
 UnnecessaryIncludeFinder::markUsed (
-    SourceLocation declarationLocation, SourceLocation usageLocation)
+    SourceLocation declarationLocation,
+    SourceLocation usageLocation,
+    const NamedDecl* pDecl,
+    StringRef macroName)
 {
+  if (pDeferredUses_ != 0) {
+    // Only declarations are traversed on other threads.
+    if (usageLocation.isValid()) {
+      defer(declarationLocation, usageLocation, pDecl);
+    }
+    return;
+  }
+
   // Is the symbol declared in an included file and is it being used in the
   // main file?
-  if (usageLocation.isInvalid() || !isFromMainFile(usageLocation)) {
+  if (usageLocation.isInvalid()) {
+    return;
+  }
+
+  FileID usageFileID = sourceManager_.getFileID(
+      sourceManager_.getExpansionLoc(usageLocation));
+  SourceFile::Ptr pMainSource = getMainSource(usageFileID);
+  if (!pMainSource) {
     return;
   }
 
@@ -240,11 +513,25 @@ UnnecessaryIncludeFinder::markUsed (
   }
 
   FileID declarationFileID = sourceManager_.getFileID(declarationLocation);
+  if (declarationFileID != usageFileID && getMainSource(declarationFileID)) {
+    // In a unity build, the declaration found may be a redeclaration in
+    // another main source file included earlier.  The use needs a
+    // declaration outside the main source files.
+    if (pDecl == 0) {
+      return;
+    }
+
+    declarationFileID = findHeaderDeclaration(pDecl);
+    if (declarationFileID.isInvalid()) {
+      return;
+    }
+  }
+
   if (sourceManager_.getSLocEntry(declarationFileID).isFile() == false) {
     return;
   }
 
-  if (declarationFileID != sourceManager_.getMainFileID()) {
+  if (declarationFileID != usageFileID) {
     const FileEntry* pFile = sourceManager_.getFileEntryForID(
         declarationFileID);
     if (pFile == 0) {
@@ -252,9 +539,46 @@ UnnecessaryIncludeFinder::markUsed (
     }
 
     UsedHeaders::key_type fileName(pFile->getName());
-    pMainSource_->usedHeaders_.insert(fileName);
+    pMainSource->usedHeaders_.insert(fileName);
     action_.allUsedHeaders_.insert(fileName);
+
+    if (action_.pSymbolIndex_ != 0) {
+      pMainSource->usedSymbols_[fileName].insert(
+          (pDecl != 0) ? pDecl->getQualifiedNameAsString() : macroName.str());
+    }
+
+    if (langOptions_.Modules) {
+      // A module is used if any of its submodules are used.
+      for (Module* pModule = headerSearch_.findModuleForHeader(pFile);
+          pModule != 0;
+          pModule = pModule->Parent)
+      {
+        UsedHeaders::key_type moduleKey(getModuleKey(pModule));
+        pMainSource->usedHeaders_.insert(moduleKey);
+        action_.allUsedHeaders_.insert(moduleKey);
+      }
+    }
+  }
+}
+
+FileID
+UnnecessaryIncludeFinder::findHeaderDeclaration (const NamedDecl* pDecl)
+{
+  for (Decl::redecl_iterator pRedecl = pDecl->redecls_begin();
+      pRedecl != pDecl->redecls_end();
+      ++pRedecl)
+  {
+    SourceLocation location = pRedecl->getLocation();
+    if (location.isInvalid()) {
+      continue;
+    }
+
+    FileID fileID = sourceManager_.getFileID(location);
+    if (!getMainSource(fileID)) {
+      return fileID;
+    }
   }
+  return FileID();
 }
 
 void
@@ -278,6 +602,14 @@ UnnecessaryIncludeFinder::InclusionDirective(
   IncludeDirective::Ptr pIncludeDirective(
       new IncludeDirective(directiveLocation, fileName, isAngled));
 
+  if (pImported != 0) {
+    // The #include directive imports a module, so the preprocessor will not
+    // enter the header.  Attach the module to the including file now.
+    pIncludeDirective->pHeader_ = getModuleSource(pImported);
+    includeStack_.back()->includeDirectives_.push_back(pIncludeDirective);
+    return;
+  }
+
   fileToIncludeDirectiveMap_.erase(pFile);
   fileToIncludeDirectiveMap_.insert(std::make_pair(pFile, pIncludeDirective));
 }
@@ -293,14 +625,63 @@ UnnecessaryIncludeFinder::getSource (const FileEntry* pFile)
   SourceFile::Ptr pSource(
       (pFile == 0)
       ? new SourceFile("") : new SourceFile(pFile->getName()));
+  if (pFile != 0) {
+    pSource->bytes_ = pFile->getSize();
+  }
   fileToSourceMap_.insert(std::make_pair(pFile, pSource));
   return pSource;
 }
 
 SourceFile::Ptr
-UnnecessaryIncludeFinder::enterHeader (const FileEntry* pFile)
+UnnecessaryIncludeFinder::getModuleSource (const Module* pModule)
+{
+  ModuleToSourceMap::iterator pPair = moduleToSourceMap_.find(pModule);
+  if (pPair != moduleToSourceMap_.end()) {
+    return pPair->second;
+  }
+
+  SourceFile::Ptr pSource(new SourceFile(getModuleKey(pModule)));
+  moduleToSourceMap_.insert(std::make_pair(pModule, pSource));
+  collectModuleFiles(pModule->getTopLevelModule(), pSource->moduleFiles_);
+
+  // A file importing the module sees the modules it exports, and the
+  // headers of the module depend on the modules it imports, so they are
+  // nested in the module like headers included by a header.
+  SmallVector<Module*, 8> nestedModules;
+  pModule->getExportedModules(nestedModules);
+  nestedModules.append(pModule->Imports.begin(), pModule->Imports.end());
+
+  std::string directiveLocation;
+  raw_string_ostream rso(directiveLocation);
+  pModule->DefinitionLoc.print(rso, sourceManager_);
+  rso.flush();
+
+  std::set<const Module*> added;
+  for (SmallVectorImpl<Module*>::iterator ppNested = nestedModules.begin();
+      ppNested != nestedModules.end();
+      ++ppNested)
+  {
+    const Module* pNested = *ppNested;
+    if (pNested == pModule || !added.insert(pNested).second) {
+      continue;
+    }
+
+    IncludeDirective::Ptr pIncludeDirective(new IncludeDirective(
+        directiveLocation, pNested->getFullModuleName(), true));
+    pIncludeDirective->pHeader_ = getModuleSource(pNested);
+    pSource->includeDirectives_.push_back(pIncludeDirective);
+  }
+  return pSource;
+}
+
+SourceFile::Ptr
+UnnecessaryIncludeFinder::enterHeader (
+    const FileEntry* pFile, SrcMgr::CharacteristicKind fileType)
 {
   SourceFile::Ptr pHeader = getSource(pFile);
+  if (fileType != SrcMgr::C_User) {
+    pHeader->system_ = true;
+  }
 
   // Find the #include directive that included this header.
   FileToIncludeDirectiveMap::iterator pPair =
@@ -318,6 +699,209 @@ UnnecessaryIncludeFinder::enterHeader (const FileEntry* pFile)
   return pHeader;
 }
 
+std::size_t
+UnnecessaryIncludeFinder::countTokens (FileID fileID)
+{
+  const llvm::MemoryBuffer* pBuffer = sourceManager_.getBuffer(fileID);
+  Lexer lexer(fileID, pBuffer, sourceManager_, langOptions_);
+
+  std::size_t count = 0;
+  Token token;
+  bool atEnd;
+  do {
+    atEnd = lexer.LexFromRawLexer(token);
+    if (token.isNot(tok::eof)) {
+      ++count;
+    }
+  } while (!atEnd);
+  return count;
+}
+
+void
+UnnecessaryIncludeFinder::addEnteredFileCost (
+    FileID fileID, const FileEntry* pFile)
+{
+  if (includeStack_.back() == pMainSource_) {
+    // Entering a header included directly by the main source file.
+    FileToIncludeDirectiveMap::iterator pPair =
+        fileToIncludeDirectiveMap_.find(pFile);
+    pCostInclude_ = pPair->second;
+    costStartTime_ = TimeRecord::getCurrentTime().getWallTime();
+  }
+
+  if (pCostInclude_) {
+    // Counting tokens lexes the file again, which the compiler does not do,
+    // so the time it takes is left out of the cost.
+    double countStartTime = TimeRecord::getCurrentTime().getWallTime();
+    pCostInclude_->cost_.bytes_ += pFile->getSize();
+    pCostInclude_->cost_.tokens_ += countTokens(fileID);
+    costStartTime_ +=
+        TimeRecord::getCurrentTime(false).getWallTime() - countStartTime;
+  }
+}
+
+void
+UnnecessaryIncludeFinder::checkSymbolIndex (
+    FileID fileID, const FileEntry* pFile)
+{
+  if (fileToPendingSymbolsMap_.count(pFile)) {
+    return;
+  }
+
+  uint64_t hash = SymbolIndex::hashContents(
+      sourceManager_.getBuffer(fileID)->getBuffer());
+  if (action_.pSymbolIndex_->isCurrent(normalizePath(pFile->getName()), hash))
+  {
+    // Remember the file was checked.
+    fileToPendingSymbolsMap_[pFile] = 0;
+    return;
+  }
+
+  PendingSymbols* pPendingSymbols = new PendingSymbols;
+  pPendingSymbols->hash_ = hash;
+  fileToPendingSymbolsMap_[pFile] = pPendingSymbols;
+}
+
+void
+UnnecessaryIncludeFinder::addPendingSymbol (
+    SourceLocation location,
+    const std::string& symbol,
+    const std::string& screenName)
+{
+  if (location.isInvalid() || symbol.empty()) {
+    return;
+  }
+
+  FileID fileID = sourceManager_.getFileID(
+      sourceManager_.getExpansionLoc(location));
+  const FileEntry* pFile = sourceManager_.getFileEntryForID(fileID);
+  FileToPendingSymbolsMap::iterator pPair =
+      fileToPendingSymbolsMap_.find(pFile);
+  if (pPair != fileToPendingSymbolsMap_.end() && pPair->second != 0) {
+    pPair->second->symbols_.insert(symbol);
+    if (!screenName.empty()) {
+      pPair->second->screenNames_.insert(screenName);
+    }
+  }
+}
+
+void
+UnnecessaryIncludeFinder::updateSymbolIndex ()
+{
+  for (FileToPendingSymbolsMap::iterator pPair =
+          fileToPendingSymbolsMap_.begin();
+      pPair != fileToPendingSymbolsMap_.end();
+      ++pPair)
+  {
+    PendingSymbols* pPendingSymbols = pPair->second;
+    if (pPendingSymbols != 0) {
+      action_.pSymbolIndex_->setSymbols(
+          normalizePath(pPair->first->getName()),
+          pPendingSymbols->hash_,
+          pPendingSymbols->symbols_,
+          pPendingSymbols->screenNames_);
+    }
+  }
+}
+
+void
+UnnecessaryIncludeFinder::defer (
+    SourceLocation declarationLocation,
+    SourceLocation usageLocation,
+    const NamedDecl* pDecl)
+{
+  DeferredUse use;
+  use.declarationLocation_ = declarationLocation;
+  use.usageLocation_ = usageLocation;
+  use.pDecl_ = pDecl;
+  pDeferredUses_->push_back(use);
+}
+
+/**
+ * Traverses a chunk of the top-level declarations, recording uses to apply
+ * later.
+ */
+class UnnecessaryIncludeFinder::TraversalTask: public ParallelTask
+{
+  UnnecessaryIncludeFinder& finder_;
+  const std::vector<Decl*>& decls_;
+  std::vector<DeferredUses>& chunkUses_;
+
+public:
+  TraversalTask (
+      UnnecessaryIncludeFinder& finder,
+      const std::vector<Decl*>& decls,
+      std::vector<DeferredUses>& chunkUses):
+    finder_(finder),
+    decls_(decls),
+    chunkUses_(chunkUses)
+  { }
+
+  virtual void run (unsigned index)
+  {
+    UnnecessaryIncludeFinder chunkFinder(
+        finder_.action_,
+        finder_.sourceManager_,
+        finder_.langOptions_,
+        finder_.headerSearch_);
+    chunkFinder.pDeferredUses_ = &chunkUses_[index];
+    chunkFinder.deferSymbols_ = !finder_.fileToPendingSymbolsMap_.empty();
+
+    std::size_t chunkCount = chunkUses_.size();
+    std::size_t begin = decls_.size() * index / chunkCount;
+    std::size_t end = decls_.size() * (index + 1) / chunkCount;
+    for (std::size_t i = begin; i < end; ++i) {
+      chunkFinder.TraverseDecl(decls_[i]);
+    }
+  }
+};
+
+void
+UnnecessaryIncludeFinder::traverseInParallel (TranslationUnitDecl* pUnit)
+{
+  std::vector<Decl*> decls;
+  for (DeclContext::decl_iterator ppDecl = pUnit->decls_begin();
+      ppDecl != pUnit->decls_end();
+      ++ppDecl)
+  {
+    // Blocks are traversed through the expressions which define them.
+    if (!isa<BlockDecl>(*ppDecl)) {
+      decls.push_back(*ppDecl);
+    }
+  }
+
+  // Divide the declarations into more chunks than threads, so a thread which
+  // drew small chunks takes more work.
+  const std::size_t CHUNKS_PER_THREAD = 8;
+  unsigned threadCount = (action_.options_.jobs_ != 0)
+      ? action_.options_.jobs_ : hardwareConcurrency();
+  std::size_t chunkCount =
+      std::min(decls.size(), threadCount * CHUNKS_PER_THREAD);
+  std::vector<DeferredUses> chunkUses(chunkCount);
+  TraversalTask task(*this, decls, chunkUses);
+  parallelFor(chunkCount, task, threadCount);
+
+  for (std::vector<DeferredUses>::iterator pUses = chunkUses.begin();
+      pUses != chunkUses.end();
+      ++pUses)
+  {
+    for (DeferredUses::iterator pUse = pUses->begin();
+        pUse != pUses->end();
+        ++pUse)
+    {
+      if (pUse->usageLocation_.isValid()) {
+        markUsed(
+            pUse->declarationLocation_, pUse->usageLocation_, pUse->pDecl_);
+      } else {
+        addPendingSymbol(
+            pUse->declarationLocation_,
+            pUse->pDecl_->getQualifiedNameAsString(),
+            getScreenName(pUse->pDecl_));
+      }
+    }
+  }
+}
+
 void
 UnnecessaryIncludeFinder::FileChanged (
     SourceLocation newLocation,
@@ -329,15 +913,31 @@ UnnecessaryIncludeFinder::FileChanged (
     FileID newFileID = sourceManager_.getFileID(newLocation);
     const FileEntry* pFile = sourceManager_.getFileEntryForID(newFileID);
     if (pFile != 0) {
-      if (newFileID == sourceManager_.getMainFileID()) {
+      if (isMainFile(newFileID, pFile)) {
         // Entering main source file for the first time.
+        mainFileID_ = newFileID;
         pMainSource_ = getSource(pFile);
+        mainSourceMap_[newFileID] = pMainSource_;
         action_.mainSources_.push_back(pMainSource_);
-        includeStack_.clear();
+        if (pMainFile_ == 0 && !unity_) {
+          includeStack_.clear();
+        }
         includeStack_.push_back(pMainSource_);
+      } else if (newFileID == sourceManager_.getMainFileID()) {
+        // Entering source file which only includes the header to analyze as
+        // the main source file, or the unity source file.
+        includeStack_.clear();
+        includeStack_.push_back(getSource(pFile));
       } else {
+        if (action_.options_.cost_) {
+          addEnteredFileCost(newFileID, pFile);
+        }
+        if (action_.pSymbolIndex_ != 0) {
+          checkSymbolIndex(newFileID, pFile);
+        }
+
         // Push new header onto include stack.
-        SourceFile::Ptr pHeader(enterHeader(pFile));
+        SourceFile::Ptr pHeader(enterHeader(pFile, fileType));
         includeStack_.push_back(pHeader);
       }
     } else {
@@ -350,6 +950,16 @@ UnnecessaryIncludeFinder::FileChanged (
   } else if (reason == PPCallbacks::ExitFile) {
     // Pop include stack.
     includeStack_.pop_back();
+
+    if (pCostInclude_
+     && !includeStack_.empty()
+     && includeStack_.back() == pMainSource_)
+    {
+      // Returned to the main source file.
+      pCostInclude_->cost_.seconds_ +=
+          TimeRecord::getCurrentTime(false).getWallTime() - costStartTime_;
+      pCostInclude_ = 0;
+    }
   }
 }
 
@@ -359,7 +969,7 @@ UnnecessaryIncludeFinder::FileSkipped (
       const Token& fileNameToken,
       SrcMgr::CharacteristicKind fileType)
 {
-  enterHeader(&file);
+  enterHeader(&file, fileType);
 }
 
 void
@@ -368,27 +978,102 @@ UnnecessaryIncludeFinder::MacroExpands (
 {
   // Ignore expansion of builtin macros like __LINE__.
   if (pMacro->isBuiltinMacro() == false) {
-    markUsed(pMacro->getDefinitionLoc(), nameToken.getLocation());
+    markUsed(
+        pMacro->getDefinitionLoc(),
+        nameToken.getLocation(),
+        0,
+        nameToken.getIdentifierInfo()->getName());
+  }
+}
+
+void
+UnnecessaryIncludeFinder::MacroDefined (
+    const Token& nameToken, const MacroInfo* pMacro)
+{
+  if (!fileToPendingSymbolsMap_.empty()) {
+    std::string name(nameToken.getIdentifierInfo()->getName());
+    addPendingSymbol(nameToken.getLocation(), name, name);
   }
 }
 
 void
 UnnecessaryIncludeFinder::HandleTranslationUnit (ASTContext& astContext)
 {
-  TraverseDecl(astContext.getTranslationUnitDecl());
+  // Declarations loaded lazily from a precompiled header, module or AST file
+  // would be deserialized by several threads at once, which is not safe.
+  if (action_.options_.parallelTraversal_
+   && astContext.getExternalSource() == 0)
+  {
+    traverseInParallel(astContext.getTranslationUnitDecl());
+  } else {
+    TraverseDecl(astContext.getTranslationUnitDecl());
+  }
+
+  if (action_.options_.cost_) {
+    for (FileIDToSourceMap::iterator pPair = mainSourceMap_.begin();
+        pPair != mainSourceMap_.end();
+        ++pPair)
+    {
+      pPair->second->countUniqueHeaders();
+    }
+  }
+
+  if (action_.pSymbolIndex_ != 0) {
+    updateSymbolIndex();
+  }
+}
+
+bool
+UnnecessaryIncludeFinder::VisitNamedDecl (NamedDecl* pDecl)
+{
+  if ((pDeferredUses_ != 0)
+      ? !deferSymbols_ : fileToPendingSymbolsMap_.empty())
+  {
+    return true;
+  }
+
+  // Record only symbols which can be named from other files.  Declarations
+  // in an extern "C" block are at namespace scope.
+  const DeclContext* pContext = pDecl->getDeclContext()->getRedeclContext();
+  if (!pContext->isFileContext()
+   && !pContext->isRecord()
+   && pContext->getDeclKind() != Decl::Enum)
+  {
+    return true;
+  }
+
+  // A forward declaration does not make the type usable.
+  const TagDecl* pTagDecl = dyn_cast<TagDecl>(pDecl);
+  if (pTagDecl != 0 && !pTagDecl->isCompleteDefinition()) {
+    return true;
+  }
+
+  if (pDeferredUses_ != 0) {
+    defer(pDecl->getLocation(), SourceLocation(), pDecl);
+  } else {
+    addPendingSymbol(
+        pDecl->getLocation(),
+        pDecl->getQualifiedNameAsString(),
+        getScreenName(pDecl));
+  }
+  return true;
 }
 
 bool
 UnnecessaryIncludeFinder::VisitTypedefTypeLoc (TypedefTypeLoc typeLoc)
 {
-  markUsed(typeLoc.getTypePtr()->getDecl()->getLocation(), typeLoc.getBeginLoc());
+  TypedefNameDecl* pDecl = typeLoc.getTypePtr()->getDecl();
+  markUsed(pDecl->getLocation(), typeLoc.getBeginLoc(), pDecl);
   return true;
 }
 
 bool
 UnnecessaryIncludeFinder::VisitTagTypeLoc(TagTypeLoc typeLoc)
 {
-  markUsed(typeLoc.getDecl()->getLocation(), typeLoc.getBeginLoc());
+  markUsed(
+      typeLoc.getDecl()->getLocation(),
+      typeLoc.getBeginLoc(),
+      typeLoc.getDecl());
   return true;
 }
 
@@ -398,7 +1083,10 @@ UnnecessaryIncludeFinder::VisitTemplateSpecializationTypeLoc (
 {
   CXXRecordDecl* pCXXRecordDecl = typeLoc.getTypePtr()->getAsCXXRecordDecl();
   if (pCXXRecordDecl) {
-    markUsed(pCXXRecordDecl->getLocation(), typeLoc.getTemplateNameLoc());
+    markUsed(
+        pCXXRecordDecl->getLocation(),
+        typeLoc.getTemplateNameLoc(),
+        pCXXRecordDecl);
   }
   return true;
 }
@@ -406,14 +1094,20 @@ UnnecessaryIncludeFinder::VisitTemplateSpecializationTypeLoc (
 bool
 UnnecessaryIncludeFinder::VisitDeclRefExpr (DeclRefExpr* pExpr)
 {
-  markUsed(pExpr->getDecl()->getLocation(), pExpr->getLocation());
+  markUsed(
+      pExpr->getDecl()->getLocation(),
+      pExpr->getLocation(),
+      pExpr->getDecl());
   return true;
 }
 
 bool
 UnnecessaryIncludeFinder::VisitMemberExpr (MemberExpr* pExpr)
 {
-  markUsed(pExpr->getMemberDecl()->getLocation(), pExpr->getMemberLoc());
+  markUsed(
+      pExpr->getMemberDecl()->getLocation(),
+      pExpr->getMemberLoc(),
+      pExpr->getMemberDecl());
   return true;
 }
 
@@ -421,7 +1115,10 @@ bool
 UnnecessaryIncludeFinder::VisitCXXMemberCallExpr (CXXMemberCallExpr* pExpr)
 {
   if (pExpr->getMethodDecl() != 0) {
-    markUsed(pExpr->getMethodDecl()->getLocation(), pExpr->getExprLoc());
+    markUsed(
+        pExpr->getMethodDecl()->getLocation(),
+        pExpr->getExprLoc(),
+        pExpr->getMethodDecl());
   }
   return true;
 }
@@ -431,16 +1128,228 @@ UnnecessaryIncludeFinderAction::CreateASTConsumer (
     CompilerInstance& compiler, StringRef inputFile)
 {
   UnnecessaryIncludeFinder* pFinder = new UnnecessaryIncludeFinder(
-      *this, compiler.getSourceManager());
+      *this,
+      compiler.getSourceManager(),
+      compiler.getLangOpts(),
+      compiler.getPreprocessor().getHeaderSearchInfo());
+
+  if (!mainHeader_.empty()) {
+    pFinder->setMainFile(compiler.getFileManager().getFile(mainHeader_));
+  }
+  if (options_.unity_) {
+    pFinder->setUnity();
+  }
 
   compiler.getPreprocessor().addPPCallbacks(
       pFinder->createPreprocessorCallbacks());
+  if (pFileCache_ != 0) {
+    compiler.getPreprocessor().addPPCallbacks(
+        pFileCache_->createPreprocessorCallbacks(compiler.getSourceManager()));
+  }
 
   return pFinder;
 }
 
+namespace {
+
+/**
+ * Orders findings by descending cost.
+ */
+class MoreCostly
+{
+  CostKey key_;
+
+public:
+  MoreCostly (CostKey key):
+    key_(key)
+  { }
+
+  bool operator() (
+      const UnnecessaryInclude& left, const UnnecessaryInclude& right) const
+  {
+    return left.pIncludeDirective_->cost_.get(key_)
+        > right.pIncludeDirective_->cost_.get(key_);
+  }
+};
+
+}//namespace
+
+void
+sortByCost (UnnecessaryIncludes& found, CostKey key)
+{
+  std::stable_sort(found.begin(), found.end(), MoreCostly(key));
+}
+
+namespace {
+
+typedef std::vector<IncludeDirective::Ptr> Candidates;
+
+/**
+ * Collects the #include directives transitively reachable from the source
+ * file, keeping the first directive found for each header.
+ */
+void
+collectCandidates (
+    SourceFile::Ptr pSource,
+    VisitedHeaders& visitedHeaders,
+    Candidates& candidates)
+{
+  for (SourceFile::IncludeDirectives::iterator ppInclude =
+          pSource->includeDirectives_.begin();
+      ppInclude != pSource->includeDirectives_.end();
+      ++ppInclude)
+  {
+    SourceFile::Ptr pHeader((*ppInclude)->pHeader_);
+    if (visitedHeaders.insert(pHeader->name()).second) {
+      candidates.push_back(*ppInclude);
+      collectCandidates(pHeader, visitedHeaders, candidates);
+    }
+  }
+}
+
+typedef std::map<std::string, std::size_t> NameToIndexMap;
+
+std::size_t
+getIndex (NameToIndexMap& nameToIndexMap, const std::string& name)
+{
+  std::size_t index = nameToIndexMap.size();
+  return nameToIndexMap.insert(std::make_pair(name, index)).first->second;
+}
+
+/**
+ * Gets the headers brought in by the header, including itself.  Each set is
+ * collected once and kept for the other findings in the same main source
+ * file, which mostly share their candidates.
+ */
+const UsedHeaders&
+getReachableHeaders (
+    std::map<const SourceFile*, UsedHeaders>& reachableHeaders,
+    SourceFile::Ptr pHeader)
+{
+  std::map<const SourceFile*, UsedHeaders>::iterator pPair =
+      reachableHeaders.find(pHeader.getPtr());
+  if (pPair != reachableHeaders.end()) {
+    return pPair->second;
+  }
+
+  UsedHeaders& headers = reachableHeaders[pHeader.getPtr()];
+  headers.insert(pHeader->name());
+  pHeader->collectNestedHeaders(headers);
+  return headers;
+}
+
+}//namespace
+
+void
+UnnecessaryIncludeFinderAction::suggestReplacement (
+    SourceFile::Ptr pMainSource,
+    UnnecessaryInclude& unnecessaryInclude,
+    SourceToHeadersMap& reachableHeaders)
+{
+  SourceFile::Ptr pReplaced(unnecessaryInclude.pIncludeDirective_->pHeader_);
+  VisitedHeaders visitedHeaders;
+  visitedHeaders.insert(pReplaced->name());
+  Candidates candidates;
+  collectCandidates(pReplaced, visitedHeaders, candidates);
+
+  // Number the headers the replaced header brings in.
+  NameToIndexMap headerIndexes;
+  std::vector<std::size_t> headerCosts;
+  getIndex(headerIndexes, pReplaced->name());
+  headerCosts.push_back(pReplaced->bytes_);
+  for (Candidates::iterator ppCandidate = candidates.begin();
+      ppCandidate != candidates.end();
+      ++ppCandidate)
+  {
+    getIndex(headerIndexes, (*ppCandidate)->pHeader_->name());
+    headerCosts.push_back((*ppCandidate)->pHeader_->bytes_);
+  }
+
+  unnecessaryInclude.replacedBytes_ = 0;
+  for (std::size_t i = 0; i < headerCosts.size(); ++i) {
+    unnecessaryInclude.replacedBytes_ += headerCosts[i];
+  }
+
+  // Find the symbols the main source file uses through the header.
+  SymbolIndex::Symbols needed;
+  if (pSymbolIndex_ != 0) {
+    for (Candidates::iterator ppCandidate = candidates.begin();
+        ppCandidate != candidates.end();
+        ++ppCandidate)
+    {
+      SourceFile::HeaderToSymbolsMap::const_iterator pPair =
+          pMainSource->usedSymbols_.find((*ppCandidate)->pHeader_->name());
+      if (pPair != pMainSource->usedSymbols_.end()) {
+        needed.insert(pPair->second.begin(), pPair->second.end());
+      }
+    }
+  }
+
+  // The items to provide are the used symbols if the symbol index is
+  // enabled, otherwise the used headers.  A candidate provides the items of
+  // every header it brings in.
+  NameToIndexMap itemIndexes;
+  std::vector<ReplacementCandidate> replacementCandidates(candidates.size());
+  for (std::size_t i = 0; i < candidates.size(); ++i) {
+    ReplacementCandidate& candidate = replacementCandidates[i];
+
+    const UsedHeaders& nestedHeaders =
+        getReachableHeaders(reachableHeaders, candidates[i]->pHeader_);
+    for (UsedHeaders::const_iterator pName = nestedHeaders.begin();
+        pName != nestedHeaders.end();
+        ++pName)
+    {
+      candidate.headers_.push_back(getIndex(headerIndexes, *pName));
+
+      if (pSymbolIndex_ == 0) {
+        if (pMainSource->usedHeaders_.count(*pName)) {
+          candidate.items_.push_back(getIndex(itemIndexes, *pName));
+        }
+        continue;
+      }
+
+      SymbolIndex::Symbols symbols;
+      SourceFile::HeaderToSymbolsMap::const_iterator pPair =
+          pMainSource->usedSymbols_.find(*pName);
+      if (pPair != pMainSource->usedSymbols_.end()) {
+        symbols = pPair->second;
+      }
+
+      const SymbolIndex::Symbols* pSymbols =
+          pSymbolIndex_->getSymbols(normalizePath(*pName));
+      if (pSymbols != 0) {
+        for (SymbolIndex::Symbols::const_iterator pSymbol = pSymbols->begin();
+            pSymbol != pSymbols->end();
+            ++pSymbol)
+        {
+          if (needed.count(*pSymbol)) {
+            symbols.insert(*pSymbol);
+          }
+        }
+      }
+
+      for (SymbolIndex::Symbols::iterator pSymbol = symbols.begin();
+          pSymbol != symbols.end();
+          ++pSymbol)
+      {
+        candidate.items_.push_back(getIndex(itemIndexes, *pSymbol));
+      }
+    }
+  }
+
+  std::vector<std::size_t> chosen = chooseReplacement(
+      replacementCandidates,
+      headerCosts,
+      itemIndexes.size(),
+      &unnecessaryInclude.suggestedBytes_);
+  for (std::size_t i = 0; i < chosen.size(); ++i) {
+    unnecessaryInclude.suggestedIncludes_.push_back(candidates[chosen[i]]);
+  }
+}
+
 bool
-UnnecessaryIncludeFinderAction::reportUnnecessaryIncludes ()
+UnnecessaryIncludeFinderAction::findUnnecessaryIncludes (
+    UnnecessaryIncludes& found)
 {
   bool foundUnnecessary = false;
 
@@ -450,11 +1359,188 @@ UnnecessaryIncludeFinderAction::reportUnnecessaryIncludes ()
   {
     SourceFile::Ptr pMainSource(*ppSource);
 
-    bool found = pMainSource->reportUnnecessaryIncludes(allUsedHeaders_);
-    if (found) {
+    std::size_t firstFound = found.size();
+    if (pMainSource->findUnnecessaryIncludes(allUsedHeaders_, found)) {
       foundUnnecessary = true;
     }
+
+    if (pSymbolIndex_ != 0 || options_.cost_) {
+      SourceToHeadersMap reachableHeaders;
+      for (std::size_t i = firstFound; i < found.size(); ++i) {
+        if (found[i].replaceable_) {
+          suggestReplacement(pMainSource, found[i], reachableHeaders);
+        }
+      }
+    }
+  }
+
+  return foundUnnecessary;
+}
+
+bool
+UnnecessaryIncludeFinderAction::reportUnnecessaryIncludes (std::ostream& out)
+{
+  UnnecessaryIncludes found;
+  bool foundUnnecessary = findUnnecessaryIncludes(found);
+
+  if (options_.sortBy_ != COST_NONE) {
+    sortByCost(found, options_.sortBy_);
+  }
+
+  for (UnnecessaryIncludes::iterator pFound = found.begin();
+      pFound != found.end();
+      ++pFound)
+  {
+    pFound->report(out, options_.cost_);
   }
 
   return foundUnnecessary;
 }
+
+bool
+UnnecessaryIncludeFinderAction::exportIncludeGraph (
+    const std::string& path, std::string& errorMessage)
+{
+  IncludeGraphWriter writer;
+  for (SourceFiles::iterator ppSource = mainSources_.begin();
+      ppSource != mainSources_.end();
+      ++ppSource)
+  {
+    writer.addTranslationUnit(*ppSource);
+  }
+
+  return writer.write(path, errorMessage);
+}
+
+void
+UnnecessaryIncludeFinderAction::merge (
+    const UnnecessaryIncludeFinderAction& other)
+{
+  mainSources_.insert(
+      mainSources_.end(), other.mainSources_.begin(), other.mainSources_.end());
+  allUsedHeaders_.insert(
+      other.allUsedHeaders_.begin(), other.allUsedHeaders_.end());
+}
+
+void
+UnnecessaryIncludeFinderAction::updateIndex (ReverseIndex& index)
+{
+  std::set<std::string> updated;
+  for (SourceFiles::iterator ppSource = mainSources_.begin();
+      ppSource != mainSources_.end();
+      ++ppSource)
+  {
+    if (updated.insert((*ppSource)->name()).second) {
+      index.update(*ppSource);
+    } else {
+      index.extend(*ppSource);
+    }
+  }
+}
+
+namespace {
+
+/**
+ * Cost of a header summed over the main source files which include it
+ * without using it.
+ */
+struct HeaderCost
+{
+  std::string name_;
+  IncludeCost cost_;
+  unsigned translationUnits_;
+
+  HeaderCost ():
+    translationUnits_(0)
+  { }
+};
+
+class MoreCostlyHeader
+{
+  CostKey key_;
+
+public:
+  MoreCostlyHeader (CostKey key):
+    key_(key)
+  { }
+
+  bool operator() (const HeaderCost& left, const HeaderCost& right) const
+  { return left.cost_.get(key_) > right.cost_.get(key_); }
+};
+
+}//namespace
+
+void
+UnnecessaryIncludeFinderAction::reportSummary (std::ostream& out)
+{
+  // Headers included by other headers are left out, because a main source
+  // file cannot remove them.
+  UsedHeaders includedHeaders;
+  typedef std::map<std::string, HeaderCost> NameToCostMap;
+  NameToCostMap nameToCostMap;
+
+  for (SourceFiles::iterator ppSource = mainSources_.begin();
+      ppSource != mainSources_.end();
+      ++ppSource)
+  {
+    SourceFile::Ptr pMainSource(*ppSource);
+
+    // A header included twice by the same main source file is counted once.
+    UsedHeaders counted;
+    for (SourceFile::IncludeDirectives::iterator ppInclude =
+            pMainSource->includeDirectives_.begin();
+        ppInclude != pMainSource->includeDirectives_.end();
+        ++ppInclude)
+    {
+      IncludeDirective::Ptr pIncludeDirective(*ppInclude);
+      const std::string& name = pIncludeDirective->pHeader_->name();
+      if (isFileName(name) && !pIncludeDirective->pHeader_->system_) {
+        includedHeaders.insert(name);
+      }
+      if (!isFileName(name)
+       || pMainSource->usedHeaders_.count(name)
+       || !counted.insert(name).second)
+      {
+        continue;
+      }
+
+      HeaderCost& headerCost = nameToCostMap[name];
+      headerCost.name_ = name;
+      headerCost.cost_ += pIncludeDirective->cost_;
+      ++headerCost.translationUnits_;
+    }
+  }
+
+  out << "Headers included but never used:" << std::endl;
+  for (UsedHeaders::iterator pName = includedHeaders.begin();
+      pName != includedHeaders.end();
+      ++pName)
+  {
+    if (!allUsedHeaders_.count(*pName)) {
+      out << "  " << *pName << std::endl;
+    }
+  }
+
+  std::vector<HeaderCost> headerCosts;
+  for (NameToCostMap::iterator pPair = nameToCostMap.begin();
+      pPair != nameToCostMap.end();
+      ++pPair)
+  {
+    headerCosts.push_back(pPair->second);
+  }
+
+  CostKey key = (options_.sortBy_ != COST_NONE) ? options_.sortBy_ : COST_BYTES;
+  std::stable_sort(
+      headerCosts.begin(), headerCosts.end(), MoreCostlyHeader(key));
+
+  out << "Headers included without being used, by total cost:" << std::endl;
+  for (std::vector<HeaderCost>::iterator pHeaderCost = headerCosts.begin();
+      pHeaderCost != headerCosts.end();
+      ++pHeaderCost)
+  {
+    out << "  " << pHeaderCost->name_ << ": ";
+    pHeaderCost->cost_.print(out);
+    out << " in " << pHeaderCost->translationUnits_
+        << " translation units" << std::endl;
+  }
+}
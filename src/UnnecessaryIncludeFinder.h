@@ -6,18 +6,61 @@
 #include "clang/Basic/SourceLocation.h"
 #include "clang/Basic/SourceManager.h"
 #include "clang/Frontend/FrontendAction.h"
+#include "clang/Lex/HeaderSearch.h"
 #include "clang/Lex/MacroInfo.h"
 #include "clang/Lex/PPCallbacks.h"
 #include "clang/Lex/Token.h"
 #include "llvm/ADT/DenseMap.h"
 #include "llvm/ADT/IntrusiveRefCntPtr.h"
+#include "SymbolIndex.h"
+#include "ToolOptions.h"
+#include <cstddef>
+#include <map>
 #include <ostream>
 #include <set>
 #include <string>
 #include <vector>
 
+class SharedFileCache;
 class SourceFile;
 
+/**
+ * Build cost attributed to an #include directive in the main source file.
+ */
+struct IncludeCost
+{
+  /** bytes of source files entered while processing the #include */
+  std::size_t bytes_;
+
+  /** tokens lexed from source files entered while processing the #include */
+  std::size_t tokens_;
+
+  /** transitive headers brought in only by this #include */
+  unsigned uniqueHeaders_;
+
+  /** wall clock seconds spent preprocessing and parsing the entered files */
+  double seconds_;
+
+  IncludeCost ():
+    bytes_(0),
+    tokens_(0),
+    uniqueHeaders_(0),
+    seconds_(0.0)
+  { }
+
+  IncludeCost& operator+=(const IncludeCost& other);
+
+  /**
+   * Gets the measure selected by the key.
+   */
+  double get(CostKey key) const;
+
+  /**
+   * Outputs the measures.
+   */
+  void print(std::ostream& out) const;
+};
+
 /**
  * #include directive appearing in the source code.
  */
@@ -38,6 +81,9 @@ public:
   /** header file included by #include directive */
   llvm::IntrusiveRefCntPtr<SourceFile> pHeader_;
 
+  /** cost of processing the header, measured if cost reporting is enabled */
+  IncludeCost cost_;
+
   IncludeDirective(
       const std::string& hashLoc,
       llvm::StringRef fileName,
@@ -72,6 +118,64 @@ public:
 
 typedef std::set<std::string> UsedHeaders;
 
+/**
+ * Checks if the name of a source file or used header names a file, not the
+ * built-in source or a module.
+ */
+bool isFileName(const std::string& name);
+
+/**
+ * #include directive reported as unnecessary or replaceable.
+ */
+struct UnnecessaryInclude
+{
+  IncludeDirective::Ptr pIncludeDirective_;
+
+  /** true if the header includes other headers that are used */
+  bool replaceable_;
+
+  /** headers used by the analyzed main source files */
+  const UsedHeaders* pAllUsedHeaders_;
+
+  /**
+   * for a replaceable #include directive, the cheapest #include directives
+   * which together provide the symbols used through it, or the headers used
+   * by the main source file if the symbol index is not enabled.  Computed if
+   * the symbol index or cost reporting is enabled.
+   */
+  std::vector<IncludeDirective::Ptr> suggestedIncludes_;
+
+  /** bytes of headers brought in by the replaceable #include directive */
+  std::size_t replacedBytes_;
+
+  /** bytes of headers brought in by the suggested #include directives */
+  std::size_t suggestedBytes_;
+
+  UnnecessaryInclude (
+      IncludeDirective::Ptr pIncludeDirective,
+      bool replaceable,
+      const UsedHeaders& allUsedHeaders):
+    pIncludeDirective_(pIncludeDirective),
+    replaceable_(replaceable),
+    pAllUsedHeaders_(&allUsedHeaders),
+    replacedBytes_(0),
+    suggestedBytes_(0)
+  { }
+
+  /**
+   * Outputs warning message.
+   */
+  void report(std::ostream& out, bool showCost);
+};
+
+typedef std::vector<UnnecessaryInclude> UnnecessaryIncludes;
+
+/**
+ * Orders findings by descending cost.  The order of findings with equal cost
+ * is kept.
+ */
+void sortByCost(UnnecessaryIncludes& found, CostKey key);
+
 /**
  * Main source file or header file.
  */
@@ -89,8 +193,29 @@ public:
   /** set of header files used by this source file */
   UsedHeaders usedHeaders_;
 
+  /**
+   * symbols used by this source file, by header declaring them, recorded if
+   * the symbol index is enabled
+   */
+  typedef std::map<std::string, SymbolIndex::Symbols> HeaderToSymbolsMap;
+  HeaderToSymbolsMap usedSymbols_;
+
+  /** size of the file, or 0 if it is not a file */
+  std::size_t bytes_;
+
+  /** true if the file was entered as a system header */
+  bool system_;
+
+  /**
+   * for a module, the headers of its top-level module and their submodules,
+   * any of which rebuilds the module when changed
+   */
+  std::vector<std::string> moduleFiles_;
+
   SourceFile (const std::string& name):
-    name_(name)
+    name_(name),
+    bytes_(0),
+    system_(false)
   { }
 
   const std::string& name () const
@@ -98,6 +223,24 @@ public:
 
   void traverse(IncludeDirectiveVisitor& visitor);
 
+  /**
+   * Adds the names of all headers transitively included by this source file.
+   */
+  void collectNestedHeaders(UsedHeaders& headers);
+
+  /**
+   * Adds the names of all files this source file transitively depends on,
+   * which are the headers it includes and the headers of the modules it
+   * imports.
+   */
+  void collectNestedFiles(UsedHeaders& files);
+
+  /**
+   * Counts, for each #include directive in this source file, the transitive
+   * headers which are not also brought in by another #include directive.
+   */
+  void countUniqueHeaders();
+
   /**
    * Checks if any of the headers included by this source file are used.
    */
@@ -106,16 +249,19 @@ public:
   /**
    * Reports the headers included by this source file that are used.
    */
-  void reportNestedUsedHeaders(const UsedHeaders& usedHeaders);
+  void reportNestedUsedHeaders(
+      std::ostream& out, const UsedHeaders& usedHeaders);
 
   /**
-   * Reports unnecessary #include directives in this source file.
+   * Finds unnecessary #include directives in this source file.
    *
    * @return true if an unnecessary #include directive was found
    */
-  bool reportUnnecessaryIncludes(const UsedHeaders& allUsedHeaders);
+  bool findUnnecessaryIncludes(
+      const UsedHeaders& allUsedHeaders, UnnecessaryIncludes& found);
 };
 
+class ReverseIndex;
 class UnnecessaryIncludeFinderAction;
 
 /**
@@ -125,6 +271,20 @@ class UnnecessaryIncludeFinderAction;
  * source file, mark the header file which defines the symbol as used.  For
  * each #include directive in the main source file, if the header has not been
  * marked as used, report the #include directive as unnecessary.
+ *
+ * When the translation unit is built with modules, an #include directive may
+ * import a module instead of entering the header.  A symbol declared in a
+ * module header marks the module and its parent modules as used, so the
+ * import can be judged without parsing the header textually.
+ *
+ * With parallel traversal, the top-level declarations are divided into
+ * chunks traversed on separate threads.  Each traversal records its uses,
+ * which are applied in declaration order once all traversals finish, so the
+ * result is the same as traversing serially.
+ *
+ * In a unity build, the main source file of the translation unit includes
+ * several source files.  Each of them is analyzed as a main source file, and
+ * symbols are marked as used by the source file which uses them.
  */
 class UnnecessaryIncludeFinder:
     public clang::PPCallbacks,
@@ -133,6 +293,8 @@ class UnnecessaryIncludeFinder:
 {
   UnnecessaryIncludeFinderAction& action_;
   clang::SourceManager& sourceManager_;
+  const clang::LangOptions& langOptions_;
+  clang::HeaderSearch& headerSearch_;
 
   // map file to last #include directive that includes it
   typedef llvm::DenseMap<const clang::FileEntry*, IncludeDirective::Ptr>
@@ -144,6 +306,11 @@ class UnnecessaryIncludeFinder:
       FileToSourceMap;
   FileToSourceMap fileToSourceMap_;
 
+  // map imported module to source representing it
+  typedef llvm::DenseMap<const clang::Module*, SourceFile::Ptr>
+      ModuleToSourceMap;
+  ModuleToSourceMap moduleToSourceMap_;
+
   // stack of included source files.  The first element pushed will be the main
   // source file.
   std::vector<SourceFile::Ptr> includeStack_;
@@ -151,25 +318,155 @@ class UnnecessaryIncludeFinder:
   // current main source file being analyzed
   SourceFile::Ptr pMainSource_;
 
-  bool isFromMainFile (clang::SourceLocation sourceLocation)
-  { return sourceManager_.isFromMainFile(sourceLocation); }
+  // header to analyze as the main source file, or null to analyze the main
+  // source file of the translation unit
+  const clang::FileEntry* pMainFile_;
+
+  // true if the main source file of the translation unit is a unity source
+  // file, and each source file it includes is analyzed as a main source file
+  bool unity_;
+
+  // file ID of the main source file currently being analyzed
+  clang::FileID mainFileID_;
+
+  // map file ID of each main source file to its source
+  typedef std::map<clang::FileID, SourceFile::Ptr> FileIDToSourceMap;
+  FileIDToSourceMap mainSourceMap_;
+
+  // #include directive in the main source file currently being processed,
+  // if cost reporting is enabled
+  IncludeDirective::Ptr pCostInclude_;
+
+  // time processing of pCostInclude_ started, moved later by the time spent
+  // counting its tokens
+  double costStartTime_;
+
+  // symbols declared by headers not current in the symbol index
+  struct PendingSymbols
+  {
+    uint64_t hash_;
+    SymbolIndex::Symbols symbols_;
+    SymbolIndex::Symbols screenNames_;
+  };
+  typedef llvm::DenseMap<const clang::FileEntry*, PendingSymbols*>
+      FileToPendingSymbolsMap;
+  FileToPendingSymbolsMap fileToPendingSymbolsMap_;
+
+  // Use found by a traversal running on another thread.  The source manager
+  // is not thread-safe, so the use is applied later on the main thread.  An
+  // invalid usage location records a declared symbol instead of a use.
+  struct DeferredUse
+  {
+    clang::SourceLocation declarationLocation_;
+    clang::SourceLocation usageLocation_;
+    const clang::NamedDecl* pDecl_;
+  };
+  typedef std::vector<DeferredUse> DeferredUses;
+
+  // if not null, uses are recorded here instead of applied
+  DeferredUses* pDeferredUses_;
+
+  // whether a deferring traversal records declared symbols
+  bool deferSymbols_;
+
+  class TraversalTask;
+
+  SourceFile::Ptr getMainSource (clang::FileID fileID)
+  {
+    if (fileID == mainFileID_) {
+      return pMainSource_;
+    }
+
+    FileIDToSourceMap::iterator pPair = mainSourceMap_.find(fileID);
+    return (pPair != mainSourceMap_.end()) ? pPair->second : SourceFile::Ptr();
+  }
+
+  bool isMainFile (clang::FileID fileID, const clang::FileEntry* pFile)
+  {
+    if (unity_) {
+      return sourceManager_.getFileID(sourceManager_.getIncludeLoc(fileID))
+          == sourceManager_.getMainFileID();
+    }
+
+    return (pMainFile_ != 0)
+        ? pFile == pMainFile_ && !pMainSource_
+        : fileID == sourceManager_.getMainFileID();
+  }
 
   SourceFile::Ptr getSource(const clang::FileEntry* pFile);
 
-  SourceFile::Ptr enterHeader(const clang::FileEntry* pFile);
+  SourceFile::Ptr enterHeader(
+      const clang::FileEntry* pFile,
+      clang::SrcMgr::CharacteristicKind fileType);
+
+  SourceFile::Ptr getModuleSource(const clang::Module* pModule);
+
+  std::size_t countTokens(clang::FileID fileID);
+
+  void addEnteredFileCost(clang::FileID fileID, const clang::FileEntry* pFile);
 
   void markUsed(
       clang::SourceLocation declarationLocation,
-      clang::SourceLocation usageLocation);
+      clang::SourceLocation usageLocation,
+      const clang::NamedDecl* pDecl,
+      llvm::StringRef macroName = llvm::StringRef());
+
+  /**
+   * Finds a declaration of the symbol outside the main source files.
+   *
+   * @return invalid if every declaration is in a main source file
+   */
+  clang::FileID findHeaderDeclaration(const clang::NamedDecl* pDecl);
+
+  void checkSymbolIndex(clang::FileID fileID, const clang::FileEntry* pFile);
+
+  void addPendingSymbol(
+      clang::SourceLocation location,
+      const std::string& symbol,
+      const std::string& screenName);
+
+  void updateSymbolIndex();
+
+  void defer(
+      clang::SourceLocation declarationLocation,
+      clang::SourceLocation usageLocation,
+      const clang::NamedDecl* pDecl);
+
+  void traverseInParallel(clang::TranslationUnitDecl* pUnit);
 
 public:
   UnnecessaryIncludeFinder (
       UnnecessaryIncludeFinderAction& action,
-      clang::SourceManager& sourceManager):
+      clang::SourceManager& sourceManager,
+      const clang::LangOptions& langOptions,
+      clang::HeaderSearch& headerSearch):
     action_(action),
-    sourceManager_(sourceManager)
+    sourceManager_(sourceManager),
+    langOptions_(langOptions),
+    headerSearch_(headerSearch),
+    pMainFile_(0),
+    unity_(false),
+    costStartTime_(0.0),
+    pDeferredUses_(0),
+    deferSymbols_(false)
   { }
 
+  ~UnnecessaryIncludeFinder();
+
+  /**
+   * Analyzes the header as if it were the main source file.  The main source
+   * file of the translation unit should include only the header.
+   */
+  void setMainFile (const clang::FileEntry* pFile)
+  { pMainFile_ = pFile; }
+
+  /**
+   * Analyzes each source file included by the unity source file, which is
+   * the main source file of the translation unit, as a main source file.
+   */
+  void setUnity ()
+  { unity_ = true; }
+
   /**
    * Creates object to receive notifications of preprocessor events.
    * We need to create a new object because the preprocessor will take
@@ -204,8 +501,14 @@ public:
       const clang::MacroInfo* pMacro,
       clang::SourceRange range);
 
+  virtual void MacroDefined(
+      const clang::Token& nameToken, const clang::MacroInfo* pMacro);
+
   virtual void HandleTranslationUnit(clang::ASTContext& astContext);
 
+  // Called when a symbol is declared.
+  bool VisitNamedDecl(clang::NamedDecl* pDecl);
+
   // Called when a typedef is used.
   bool VisitTypedefTypeLoc(clang::TypedefTypeLoc typeLoc);
 
@@ -230,23 +533,112 @@ class UnnecessaryIncludeFinderAction: public clang::ASTFrontendAction
 {
   friend class UnnecessaryIncludeFinder;
 
-  // all main source files that have been analyzed
+public:
   typedef std::vector<SourceFile::Ptr> SourceFiles;
+
+private:
+  const ToolOptions& options_;
+
+  // all main source files that have been analyzed
   SourceFiles mainSources_;
 
   // union of header files used by all main source files
   UsedHeaders allUsedHeaders_;
 
+  // header to analyze as the main source file, or empty for none
+  std::string mainHeader_;
+
+  // symbols declared by each header, or null if not enabled
+  SymbolIndex* pSymbolIndex_;
+
+  // contents of files read by other compiler instances, or null for none
+  SharedFileCache* pFileCache_;
+
+  // headers brought in by each header, including itself
+  typedef std::map<const SourceFile*, UsedHeaders> SourceToHeadersMap;
+
+  void suggestReplacement(
+      SourceFile::Ptr pMainSource,
+      UnnecessaryInclude& unnecessaryInclude,
+      SourceToHeadersMap& reachableHeaders);
+
 public:
+  UnnecessaryIncludeFinderAction (const ToolOptions& options):
+    options_(options),
+    pSymbolIndex_(0),
+    pFileCache_(0)
+  { }
+
   virtual clang::ASTConsumer* CreateASTConsumer(
       clang::CompilerInstance& compiler, llvm::StringRef inputFile);
 
   /**
-   * Reports unnecessary #include directives.
+   * Analyzes the header as if it were the main source file.  The main source
+   * file of the translation unit should include only the header.
+   */
+  void setMainHeader (const std::string& fileName)
+  { mainHeader_ = fileName; }
+
+  /**
+   * Records the symbols declared by headers in the index, and uses the index
+   * to suggest which headers to include instead of a replaceable header.
+   */
+  void setSymbolIndex (SymbolIndex* pSymbolIndex)
+  { pSymbolIndex_ = pSymbolIndex; }
+
+  /**
+   * Reads included files from the cache when it has them.  The compiler
+   * instance must be attached to the cache.
+   */
+  void setFileCache (SharedFileCache* pFileCache)
+  { pFileCache_ = pFileCache; }
+
+  /** all main source files that have been analyzed */
+  const SourceFiles& mainSources () const
+  { return mainSources_; }
+
+  /**
+   * Adds the main source files analyzed by another action, so the index,
+   * include graph and summary cover them.
+   */
+  void merge(const UnnecessaryIncludeFinderAction& other);
+
+  /**
+   * Finds unnecessary #include directives in the analyzed main source files.
    *
    * @return true if any unnecessary #include directives were found
    */
-  bool reportUnnecessaryIncludes();
+  bool findUnnecessaryIncludes(UnnecessaryIncludes& found);
+
+  /**
+   * Reports unnecessary #include directives, ordered by cost if requested.
+   *
+   * @return true if any unnecessary #include directives were found
+   */
+  bool reportUnnecessaryIncludes(std::ostream& out);
+
+  /**
+   * Writes the include graphs and used headers of all analyzed main source
+   * files in binary format.  See IncludeGraph.h for the format.
+   *
+   * @return false if the file could not be written
+   */
+  bool exportIncludeGraph(const std::string& path, std::string& errorMessage);
+
+  /**
+   * Records the include closures of all analyzed main source files.  The
+   * closure of a main source file analyzed more than once, as in several
+   * configurations, is the union of the closures found.
+   */
+  void updateIndex(ReverseIndex& index);
+
+  /**
+   * Reports, across all analyzed main source files, the headers which are
+   * included directly by a main source file but never used, and the headers
+   * ordered by the total cost of the #include directives which include them
+   * without using them.  System headers are not reported as never used.
+   */
+  void reportSummary(std::ostream& out);
 };
 
 #endif
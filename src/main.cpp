@@ -1,10 +1,25 @@
 #include "clang/Basic/Version.h"
 #include "clang/Frontend/CompilerInstance.h"
+#include "clang/Lex/PreprocessorOptions.h"
 #include "llvm/Support/ManagedStatic.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "ASTFileInput.h"
+#include "Batch.h"
+#include "Driver.h"
+#include "FastScreen.h"
+#include "HeaderMapCache.h"
+#include "IncludeGraph.h"
+#include "PathUtil.h"
+#include "Plan.h"
+#include "ReverseIndex.h"
+#include "SymbolIndex.h"
+#include "ToolOptions.h"
 #include "UnnecessaryIncludeFinder.h"
 #include "version.h"
 #include <cstdlib>
+#include <fstream>
 #include <iostream>
+#include <set>
 #include <vector>
 
 using namespace clang;
@@ -14,6 +29,9 @@ namespace {
 
 const std::string PROGRAM_NAME("find-unnecessary-includes");
 
+// name of the unity source file synthesized in memory
+const char UNITY_FILE_NAME[] = "unity.fui.cpp";
+
 void
 showHelp ()
 {
@@ -26,13 +44,74 @@ showHelp ()
       "  -D<macro>[=def]         define preprocessor macro\n"
       "  -I<dir>                 add include directory\n"
       "  -include <file>         include file before main source\n"
+      "  -fmodules               import modules instead of including headers\n"
+      "  -fmodules-cache-path=<dir>\n"
+      "                          directory of the module cache\n"
+      "  --cost                  report build cost of each finding\n"
+      "  --sort-by=<key>         sort findings by descending cost\n"
+      "                          (bytes, tokens, headers or time)\n"
+      "  --summary               report headers never used and total cost of\n"
+      "                          including headers without using them\n"
+      "  --export-graph=<file>   write include graph in binary format\n"
+      "  --dump-graph=<file>     print include graph written by\n"
+      "                          --export-graph, for the translation units\n"
+      "                          of the inputs, or all if none are given\n"
+      "  --index=<file>          read and update reverse include index\n"
+      "  --changed-files=<file>  analyze only inputs affected by the files\n"
+      "                          listed one per line in <file>\n"
+      "  --config=<options>      analyze in a configuration given by extra\n"
+      "                          clang options.  Repeat to report only\n"
+      "                          #includes unnecessary in all configurations\n"
+      "  --headers=<path>        analyze each header as a main source file,\n"
+      "                          where path is a header, a directory to\n"
+      "                          search or a file listing headers\n"
+      "  --jobs=<n>              number of threads to run\n"
+      "  --symbol-index=<file>   read and update index of symbols declared by\n"
+      "                          headers, to suggest headers to include\n"
+      "                          instead of a replaceable header\n"
+      "  --batch                 analyze each input in a child process, so a\n"
+      "                          failing input does not stop the others\n"
+      "  --timeout=<seconds>     with --batch, time allowed for each input\n"
+      "  --memory-limit=<MB>     with --batch, memory allowed for each child\n"
+      "  --recycle-after=<n>     with --batch, replace each child process\n"
+      "                          after it analyzes n inputs (default 50)\n"
+      "  --compile-commands=<dir>\n"
+      "                          analyze the inputs listed in\n"
+      "                          <dir>/compile_commands.json, once for each\n"
+      "                          distinct set of relevant options\n"
+      "  --cost-history=<file>   read and update time spent on each input,\n"
+      "                          to start the largest inputs first\n"
+      "  --fast                  with --symbol-index, lex the inputs without\n"
+      "                          parsing, and fully analyze only those with\n"
+      "                          #includes whose symbols are not named in\n"
+      "                          the source\n"
+      "  --fast-only             like --fast, but report those #includes as\n"
+      "                          heuristic findings instead of fully\n"
+      "                          analyzing the inputs, unless they include\n"
+      "                          headers missing from the symbol index\n"
+      "  --parallel-traversal    traverse the declarations of each input on\n"
+      "                          --jobs threads\n"
+      "  --unity                 parse all source inputs once, as a unity\n"
+      "                          build including each of them, and report\n"
+      "                          each of them separately\n"
+      "  --header-map-cache=<dir>\n"
+      "                          keep an index of the files in each -I and\n"
+      "                          -iquote directory in <dir>, to search\n"
+      "                          include directories without probing each\n"
+      "                          of them\n"
+      "\n"
+      "Inputs ending in .ast are serialized AST files written by\n"
+      "clang -emit-ast, analyzed without parsing.  Add\n"
+      "-Xclang -detailed-preprocessing-record when writing them to also\n"
+      "account for macros and headers skipped by include guards.\n"
       "\n"
-      "Many clang options are also supported.  "
-      "See the clang manual for more options.\n";
+      "Many clang options are also supported.  Options not listed above,\n"
+      "including those starting with --, are passed to clang.  See the\n"
+      "clang manual for more options.\n";
 }
 
 bool
-handleFrontEndOptions (FrontendOptions& opt)
+handleFrontEndOptions (FrontendOptions& opt, const ToolOptions& options)
 {
   if (opt.ShowVersion) {
     std::cout << PROGRAM_NAME << ' ' << FUI_VERSION
@@ -45,6 +124,15 @@ handleFrontEndOptions (FrontendOptions& opt)
     return false;
   }
 
+  if (!options.headers_.empty()
+   || !options.compileCommandsDir_.empty()
+   || !options.dumpGraphFile_.empty())
+  {
+    // Headers or the compilation database give the inputs, or inputs are
+    // optional.
+    return true;
+  }
+
   if (opt.Inputs.empty() || opt.Inputs.at(0).getFile() == "-") {
     showHelp();
     return false;
@@ -53,11 +141,270 @@ handleFrontEndOptions (FrontendOptions& opt)
   return true;
 }
 
+/**
+ * Removes inputs whose include closure does not contain a changed file.  An
+ * input not recorded in the index is always kept.
+ *
+ * @return false if the list of changed files could not be read
+ */
+bool
+selectAffectedInputs (
+    const std::string& changedFilesFile,
+    const ReverseIndex& index,
+    PlannedInputs& inputs)
+{
+  std::ifstream in(changedFilesFile.c_str());
+  if (!in) {
+    std::cerr << "error: cannot read " << changedFilesFile << std::endl;
+    return false;
+  }
+
+  ReverseIndex::Names affected;
+  std::string line;
+  while (std::getline(in, line)) {
+    if (!line.empty() && line[line.size() - 1] == '\r') {
+      line.erase(line.size() - 1);
+    }
+    if (!line.empty()) {
+      index.findAffected(normalizePath(line), affected);
+    }
+  }
+
+  PlannedInputs selected;
+  for (PlannedInputs::iterator pInput = inputs.begin();
+      pInput != inputs.end();
+      ++pInput)
+  {
+    std::string input(normalizePath(pInput->input_.getFile()));
+    if (affected.count(input) || !index.contains(input)) {
+      selected.push_back(*pInput);
+    }
+  }
+
+  inputs.swap(selected);
+  return true;
+}
+
+/**
+ * Removes the inputs whose #include directives were all cleared by the fast
+ * screen, which leaves the inputs the screen could not decide for the full
+ * analysis.  With --fast-only, reports the directives not cleared as
+ * heuristic findings instead, except in inputs including a header without a
+ * current entry in the symbol index.  Those inputs are kept, so the full
+ * analysis records the entries and later runs can screen them.
+ *
+ * @return true if a heuristic finding was reported
+ */
+bool
+screenInputs (
+    CompilerInstance& compiler,
+    const ToolOptions& options,
+    const SymbolIndex& symbolIndex,
+    std::vector<FrontendInputFile>& inputs)
+{
+  FastScreen screen(compiler, symbolIndex);
+  bool found = false;
+
+  std::vector<FrontendInputFile> undecided;
+  for (std::vector<FrontendInputFile>::iterator pInput = inputs.begin();
+      pInput != inputs.end();
+      ++pInput)
+  {
+    std::vector<ScreenedInclude> uncleared;
+    if (pInput->getKind() == IK_AST || !screen.screen(*pInput, uncleared)) {
+      // AST files are not lexed.  Let the full analysis handle them and
+      // report files which could not be read.
+      undecided.push_back(*pInput);
+      continue;
+    }
+
+    if (!options.fastOnly_) {
+      // The full analysis reports the input.
+      if (!uncleared.empty()) {
+        undecided.push_back(*pInput);
+      }
+      continue;
+    }
+
+    bool indexed = true;
+    for (std::vector<ScreenedInclude>::iterator pInclude = uncleared.begin();
+        pInclude != uncleared.end();
+        ++pInclude)
+    {
+      indexed = indexed && pInclude->indexed_;
+    }
+    if (!indexed) {
+      undecided.push_back(*pInput);
+      continue;
+    }
+
+    for (std::vector<ScreenedInclude>::iterator pInclude = uncleared.begin();
+        pInclude != uncleared.end();
+        ++pInclude)
+    {
+      pInclude->report(std::cout);
+      found = true;
+    }
+  }
+
+  inputs.swap(undecided);
+  return found;
+}
+
+/**
+ * Reports the summary, updates the index and exports the include graph of
+ * the main source files analyzed by the action, as the options request.
+ *
+ * @return false if a file could not be written
+ */
+bool
+writeResults (
+    UnnecessaryIncludeFinderAction& action,
+    const ToolOptions& options,
+    ReverseIndex& index)
+{
+  if (options.summary_) {
+    action.reportSummary(std::cout);
+  }
+
+  bool succeeded = true;
+  if (!options.indexFile_.empty()) {
+    action.updateIndex(index);
+
+    std::string errorMessage;
+    if (!index.save(options.indexFile_, errorMessage)) {
+      std::cerr << "error: " << errorMessage << std::endl;
+      succeeded = false;
+    }
+  }
+
+  if (!options.exportGraphFile_.empty()) {
+    std::string errorMessage;
+    if (!action.exportIncludeGraph(options.exportGraphFile_, errorMessage)) {
+      std::cerr << "error: " << errorMessage << std::endl;
+      succeeded = false;
+    }
+  }
+  return succeeded;
+}
+
+void
+dumpTranslationUnit (const IncludeGraph& graph, uint32_t translationUnit)
+{
+  std::cout << graph.fileName(graph.mainFile(translationUnit)).str()
+      << std::endl;
+
+  for (IncludeGraph::EdgeIterator pEdge = graph.edgesBegin(translationUnit);
+      pEdge != graph.edgesEnd(translationUnit);
+      ++pEdge)
+  {
+    std::cout << "  " << graph.fileName(pEdge->from).str() << " includes "
+        << graph.fileName(pEdge->to).str() << std::endl;
+  }
+
+  for (uint32_t file = 0; file < graph.fileCount(); ++file) {
+    if (graph.isUsed(translationUnit, file)) {
+      std::cout << "  uses " << graph.fileName(file).str() << std::endl;
+    }
+  }
+}
+
+/**
+ * Prints the translation units of an include graph file whose main source
+ * file is an input, or every translation unit if there are no inputs.
+ *
+ * @return false if the file could not be read or an input is not in it
+ */
+bool
+dumpIncludeGraph (
+    const std::string& path, const std::vector<FrontendInputFile>& inputs)
+{
+  IncludeGraph graph;
+  std::string errorMessage;
+  if (!graph.open(path, errorMessage)) {
+    std::cerr << "error: " << errorMessage << std::endl;
+    return false;
+  }
+
+  bool succeeded = true;
+  bool haveInputs = false;
+  for (std::vector<FrontendInputFile>::const_iterator pInput = inputs.begin();
+      pInput != inputs.end();
+      ++pInput)
+  {
+    if (pInput->getFile() == "-") {
+      // clang reads standard input when no input is given.
+      continue;
+    }
+
+    haveInputs = true;
+    uint32_t file = graph.findFile(normalizePath(pInput->getFile()));
+    bool found = false;
+    for (uint32_t i = 0;
+        file != IncludeGraph::NOT_FOUND && i < graph.translationUnitCount();
+        ++i)
+    {
+      if (graph.mainFile(i) == file) {
+        dumpTranslationUnit(graph, i);
+        found = true;
+      }
+    }
+    if (!found) {
+      std::cerr << "error: " << pInput->getFile().str()
+          << " is not a main source file in " << path << std::endl;
+      succeeded = false;
+    }
+  }
+
+  if (!haveInputs) {
+    for (uint32_t i = 0; i < graph.translationUnitCount(); ++i) {
+      dumpTranslationUnit(graph, i);
+    }
+  }
+  return succeeded;
+}
+
+/**
+ * Replaces the source inputs by a unity source file, synthesized in memory,
+ * which includes each of them once.
+ */
+void
+makeUnityInput (
+    CompilerInstance& compiler, std::vector<FrontendInputFile>& inputs)
+{
+  std::string contents;
+  std::set<std::string> included;
+  for (std::vector<FrontendInputFile>::iterator pInput = inputs.begin();
+      pInput != inputs.end();
+      ++pInput)
+  {
+    std::string path(normalizePath(pInput->getFile()));
+    if (included.insert(path).second) {
+      contents += "#include \"" + path + "\"\n";
+    }
+  }
+
+  // The compiler takes ownership of the buffer.
+  compiler.getPreprocessorOpts().addRemappedFile(
+      UNITY_FILE_NAME,
+      MemoryBuffer::getMemBufferCopy(contents, UNITY_FILE_NAME));
+
+  FrontendInputFile unityInput(UNITY_FILE_NAME, inputs.front().getKind());
+  inputs.assign(1, unityInput);
+}
+
 }//namespace
 
 int
 main (int argc, char* argv[])
 {
+  ToolOptions options;
+  std::vector<const char*> clangArgs;
+  if (!options.parse(argc, argv, clangArgs)) {
+    showHelp();
+    return EXIT_FAILURE;
+  }
+
   CompilerInstance compiler;
 
   // Create diagnostics so errors while processing command line arguments can
@@ -66,22 +413,23 @@ main (int argc, char* argv[])
 
   CompilerInvocation::CreateFromArgs(
       compiler.getInvocation(),
-      &argv[1],
-      &argv[1] + argc - 1,
+      clangArgs.data(),
+      clangArgs.data() + clangArgs.size(),
       compiler.getDiagnostics());
 
-  if (!handleFrontEndOptions(compiler.getFrontendOpts())) {
+  if (!handleFrontEndOptions(compiler.getFrontendOpts(), options)) {
     return EXIT_FAILURE;
   }
 
-  if (compiler.getHeaderSearchOpts().UseBuiltinIncludes
-   && compiler.getHeaderSearchOpts().ResourceDir.empty())
-  {
-    compiler.getHeaderSearchOpts().ResourceDir =
-        CompilerInvocation::GetResourcesPath(
-            argv[0], reinterpret_cast<void*>(showHelp));
+  if (!options.dumpGraphFile_.empty()) {
+    bool dumped = dumpIncludeGraph(
+        options.dumpGraphFile_, compiler.getFrontendOpts().Inputs);
+    llvm_shutdown();
+    return dumped ? EXIT_SUCCESS : EXIT_FAILURE;
   }
 
+  setResourceDir(compiler, argv[0]);
+
   if (compiler.getLangOpts().MicrosoftMode) {
     // TODO: Kludge to allow clang to parse Microsoft headers.
     // Visual C++ does name resolution at template instantiation, but clang does
@@ -90,10 +438,177 @@ main (int argc, char* argv[])
     // that point. It is declared later in the <xutility> header file.
   }
 
-  UnnecessaryIncludeFinderAction action;
-  compiler.ExecuteAction(action);
-  bool foundUnnecessary = action.reportUnnecessaryIncludes();
+  ReverseIndex index;
+  if (!options.indexFile_.empty()) {
+    std::string errorMessage;
+    if (!index.load(options.indexFile_, errorMessage)) {
+      std::cerr << "error: " << errorMessage << std::endl;
+      return EXIT_FAILURE;
+    }
+  }
+
+  if (!options.headers_.empty()) {
+    Driver driver(options, clangArgs, argv[0]);
+    bool found;
+    if (!driver.analyzeHeaders(std::cout, found)) {
+      // The headers to analyze could not be found, which is reported.
+      llvm_shutdown();
+      return EXIT_FAILURE;
+    }
+    if (!writeResults(driver.results(), options, index)) {
+      found = true;
+    }
+
+    llvm_shutdown();
+    return found ? EXIT_FAILURE : EXIT_SUCCESS;
+  }
+
+  std::vector<FrontendInputFile>& commandLineInputs =
+      compiler.getFrontendOpts().Inputs;
+  PlannedInputs inputs;
+  if (options.compileCommandsDir_.empty()) {
+    inputs.assign(commandLineInputs.begin(), commandLineInputs.end());
+  } else {
+    std::string errorMessage;
+    if (!loadCompileCommands(
+        options.compileCommandsDir_,
+        compiler.getHeaderSearchOpts().ResourceDir,
+        inputs,
+        errorMessage))
+    {
+      std::cerr << "error: " << errorMessage << std::endl;
+      return EXIT_FAILURE;
+    }
+  }
+
+  if (!options.changedFilesFile_.empty()) {
+    if (!selectAffectedInputs(options.changedFilesFile_, index, inputs)) {
+      return EXIT_FAILURE;
+    }
+
+    if (inputs.empty()) {
+      // No input is affected by the changes.
+      llvm_shutdown();
+      return EXIT_SUCCESS;
+    }
+  }
+
+  if (options.batch_
+   || !options.configurations_.empty()
+   || !options.compileCommandsDir_.empty())
+  {
+    removeEquivalentInputs(inputs);
+
+    Driver driver(options, clangArgs, argv[0]);
+    if (!options.costHistoryFile_.empty()) {
+      std::string errorMessage;
+      if (!driver.costHistory().load(options.costHistoryFile_, errorMessage))
+      {
+        std::cerr << "error: " << errorMessage << std::endl;
+        return EXIT_FAILURE;
+      }
+    }
+    estimateCosts(inputs, driver.costHistory());
+
+    bool found;
+    if (options.batch_) {
+      Batch batch(driver);
+      found = batch.run(inputs, std::cout);
+    } else {
+      found = driver.analyzeConfigurations(inputs, std::cout);
+      if (!writeResults(driver.results(), options, index)) {
+        found = true;
+      }
+    }
+
+    if (!options.costHistoryFile_.empty()) {
+      std::string errorMessage;
+      if (!driver.costHistory().save(options.costHistoryFile_, errorMessage))
+      {
+        std::cerr << "error: " << errorMessage << std::endl;
+        found = true;
+      }
+    }
+
+    llvm_shutdown();
+    return found ? EXIT_FAILURE : EXIT_SUCCESS;
+  }
+
+  commandLineInputs.clear();
+  for (PlannedInputs::iterator pInput = inputs.begin();
+      pInput != inputs.end();
+      ++pInput)
+  {
+    commandLineInputs.push_back(pInput->input_);
+  }
+
+  SymbolIndex symbolIndex;
+  if (!options.symbolIndexFile_.empty()) {
+    std::string errorMessage;
+    if (!symbolIndex.load(options.symbolIndexFile_, errorMessage)) {
+      std::cerr << "error: " << errorMessage << std::endl;
+      return EXIT_FAILURE;
+    }
+  }
+
+  bool foundHeuristic = false;
+  if (options.fast_) {
+    foundHeuristic = screenInputs(
+        compiler, options, symbolIndex, commandLineInputs);
+
+    if (commandLineInputs.empty()) {
+      llvm_shutdown();
+      return foundHeuristic ? EXIT_FAILURE : EXIT_SUCCESS;
+    }
+  }
+
+  UnnecessaryIncludeFinderAction action(options);
+  if (!options.symbolIndexFile_.empty()) {
+    action.setSymbolIndex(&symbolIndex);
+  }
+
+  // Serialized AST files are analyzed without parsing.
+  bool failed = false;
+  std::vector<FrontendInputFile> sourceInputs;
+  for (std::vector<FrontendInputFile>::iterator pInput =
+          commandLineInputs.begin();
+      pInput != commandLineInputs.end();
+      ++pInput)
+  {
+    if (pInput->getKind() != IK_AST) {
+      sourceInputs.push_back(*pInput);
+    } else if (!analyzeASTFile(action, compiler, pInput->getFile().str())) {
+      std::cerr << "error: cannot analyze " << pInput->getFile().str()
+          << std::endl;
+      failed = true;
+    }
+  }
+
+  HeaderMapCache headerMapCache(options.headerMapCacheDir_);
+  if (!sourceInputs.empty()) {
+    if (options.unity_) {
+      makeUnityInput(compiler, sourceInputs);
+    }
+    if (!options.headerMapCacheDir_.empty()) {
+      headerMapCache.attach(compiler);
+    }
+    commandLineInputs.swap(sourceInputs);
+    compiler.ExecuteAction(action);
+  }
+  bool foundUnnecessary = action.reportUnnecessaryIncludes(std::cout);
+  if (!writeResults(action, options, index)) {
+    failed = true;
+  }
+
+  if (!options.symbolIndexFile_.empty()) {
+    std::string errorMessage;
+    if (!symbolIndex.save(options.symbolIndexFile_, errorMessage)) {
+      std::cerr << "error: " << errorMessage << std::endl;
+      failed = true;
+    }
+  }
 
   llvm_shutdown();
-  return foundUnnecessary ? EXIT_FAILURE : EXIT_SUCCESS;
+  return (foundUnnecessary || foundHeuristic || failed)
+      ? EXIT_FAILURE : EXIT_SUCCESS;
 }
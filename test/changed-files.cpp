@@ -0,0 +1,3 @@
+#include "Base.h"
+
+int i;
@@ -0,0 +1,3 @@
+#include "macro.h"
+
+int i;
@@ -0,0 +1,4 @@
+#include <Circle.h>
+#include "macro.h"
+
+struct Circle circle;
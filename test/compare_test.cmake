@@ -1,14 +1,24 @@
 # $Id$
 
-set(TEST_EXPECTED "${TEST_INPUT}-expected")
-set(TEST_ACTUAL "${TEST_INPUT}-actual")
+set(TEST_EXPECTED "${TEST_NAME}-expected")
+set(TEST_ACTUAL "${TEST_NAME}-actual")
+
+# The arguments are separated by | to pass them in a single definition.
+string(REPLACE "|" ";" TEST_ARGS "${TEST_ARGS}")
 
 # Run test command, capturing standard output.
 execute_process(
-    COMMAND ${TEST_COMMAND} ${TEST_INPUT}
-    OUTPUT_FILE ${TEST_ACTUAL}
+    COMMAND ${TEST_COMMAND} ${TEST_ARGS}
+    OUTPUT_VARIABLE TEST_OUTPUT
 )
 
+# Times vary between runs, and files named by absolute paths are reported
+# relative to the test directory.
+string(REGEX REPLACE "[0-9]+\\.[0-9]+ ms" "<time> ms"
+    TEST_OUTPUT "${TEST_OUTPUT}")
+string(REPLACE "${TEST_SOURCE_DIR}/" "" TEST_OUTPUT "${TEST_OUTPUT}")
+file(WRITE ${TEST_ACTUAL} "${TEST_OUTPUT}")
+
 # Compare actual output with expected output.
 execute_process(
     COMMAND ${CMAKE_COMMAND} -E compare_files ${TEST_EXPECTED} ${TEST_ACTUAL}
@@ -16,5 +26,5 @@ execute_process(
 )
 
 if(TEST_RESULT)
-  message(FATAL_ERROR "Failed for input ${TEST_INPUT}: did not produce expected output")
+  message(FATAL_ERROR "Failed for test ${TEST_NAME}: did not produce expected output")
 endif()
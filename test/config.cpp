@@ -0,0 +1,9 @@
+#include "Base.h"
+#include "macro.h"
+#include "List.h"
+
+#ifdef USE_MACRO
+int i[MACRO];
+#endif
+
+Identifier id;
@@ -0,0 +1,4 @@
+#include "macro.h"
+#include "Base.h"
+
+int i;
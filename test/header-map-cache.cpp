@@ -0,0 +1,4 @@
+#include <Base.h>
+#include <List.h>
+
+List<int> list;
@@ -0,0 +1,8 @@
+#ifndef HEADER_UNUSED_H
+#define HEADER_UNUSED_H
+
+#include "Base.h"
+
+int f();
+
+#endif
@@ -0,0 +1,4 @@
+#include <Shapes.h>
+#include <Square.h>
+
+struct Circle circle;
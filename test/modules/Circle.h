@@ -0,0 +1,8 @@
+#ifndef CIRCLE_H
+#define CIRCLE_H
+
+struct Circle {
+  int radius;
+};
+
+#endif
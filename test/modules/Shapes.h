@@ -0,0 +1,7 @@
+#ifndef SHAPES_H
+#define SHAPES_H
+
+#include "Circle.h"
+#include "Square.h"
+
+#endif
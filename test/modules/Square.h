@@ -0,0 +1,8 @@
+#ifndef SQUARE_H
+#define SQUARE_H
+
+struct Square {
+  int side;
+};
+
+#endif
@@ -0,0 +1,4 @@
+#include "Base.h"
+#include "macro.h"
+
+Identifier id;
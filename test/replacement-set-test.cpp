@@ -0,0 +1,120 @@
+// Unit test of chooseReplacement, which does not need clang.
+
+#include "ReplacementSet.h"
+#include <cstdlib>
+#include <iostream>
+
+namespace {
+
+// Candidates of the core instance, on which the greedy choice is not the
+// cheapest.  Each candidate brings in only itself.
+const std::size_t WIDE = 0;   // provides B and C for 20
+const std::size_t LEFT = 1;   // provides A and B for 22
+const std::size_t RIGHT = 2;  // provides C and D for 22
+
+const std::size_t ITEM_A = 0;
+const std::size_t ITEM_B = 1;
+const std::size_t ITEM_C = 2;
+const std::size_t ITEM_D = 3;
+const std::size_t ITEM_COUNT = 4;
+
+// cost of a candidate which is never worth choosing
+const std::size_t PADDING_COST = 1000;
+
+unsigned failures = 0;
+
+void
+addCandidate (
+    std::vector<ReplacementCandidate>& candidates,
+    std::vector<std::size_t>& headerCosts,
+    std::size_t cost,
+    std::size_t item1,
+    std::size_t item2)
+{
+  ReplacementCandidate candidate;
+  candidate.headers_.push_back(headerCosts.size());
+  candidate.items_.push_back(item1);
+  candidate.items_.push_back(item2);
+  candidates.push_back(candidate);
+  headerCosts.push_back(cost);
+}
+
+/**
+ * Builds the core instance followed by padding candidates which provide an
+ * item at a cost too high to choose, and one candidate which provides
+ * nothing.
+ */
+void
+buildCandidates (
+    std::size_t usefulCount,
+    std::vector<ReplacementCandidate>& candidates,
+    std::vector<std::size_t>& headerCosts)
+{
+  addCandidate(candidates, headerCosts, 20, ITEM_B, ITEM_C);
+  addCandidate(candidates, headerCosts, 22, ITEM_A, ITEM_B);
+  addCandidate(candidates, headerCosts, 22, ITEM_C, ITEM_D);
+  while (candidates.size() < usefulCount) {
+    addCandidate(candidates, headerCosts, PADDING_COST, ITEM_A, ITEM_D);
+  }
+
+  ReplacementCandidate useless;
+  useless.headers_.push_back(headerCosts.size());
+  candidates.push_back(useless);
+  headerCosts.push_back(1);
+}
+
+void
+check (
+    const char* name,
+    std::size_t usefulCount,
+    const std::vector<std::size_t>& expectedChosen,
+    std::size_t expectedCost)
+{
+  std::vector<ReplacementCandidate> candidates;
+  std::vector<std::size_t> headerCosts;
+  buildCandidates(usefulCount, candidates, headerCosts);
+
+  std::size_t cost = 0;
+  std::vector<std::size_t> chosen =
+      chooseReplacement(candidates, headerCosts, ITEM_COUNT, &cost);
+  if (chosen != expectedChosen || cost != expectedCost) {
+    std::cerr << name << ": chose";
+    for (std::size_t i = 0; i < chosen.size(); ++i) {
+      std::cerr << ' ' << chosen[i];
+    }
+    std::cerr << " at cost " << cost << ", expected cost " << expectedCost
+        << std::endl;
+    ++failures;
+  }
+}
+
+}//namespace
+
+int
+main ()
+{
+  // Up to 16 useful candidates, the search finds the cheapest choice.
+  std::vector<std::size_t> exact;
+  exact.push_back(LEFT);
+  exact.push_back(RIGHT);
+  check("3 candidates", 3, exact, 44);
+  check("16 candidates", 16, exact, 44);
+
+  // With more, the greedy choice takes the candidate with the lowest cost per
+  // item first, and needs both others to complete it.
+  std::vector<std::size_t> greedy;
+  greedy.push_back(WIDE);
+  greedy.push_back(LEFT);
+  greedy.push_back(RIGHT);
+  check("17 candidates", 17, greedy, 64);
+
+  // Nothing to provide.
+  std::vector<ReplacementCandidate> candidates;
+  std::vector<std::size_t> headerCosts;
+  if (!chooseReplacement(candidates, headerCosts, 0).empty()) {
+    std::cerr << "no candidates: chose a candidate" << std::endl;
+    ++failures;
+  }
+
+  return (failures == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
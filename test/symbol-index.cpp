@@ -0,0 +1,3 @@
+#include "Derived.h"
+
+Base* pBase;